@@ -0,0 +1,157 @@
+/// @file chainBench.cpp
+/// @brief Benchmark of the ways to ask "what can I afford".
+///
+/// For chains of 4 and 16 items, answers a million budgets with the virtual
+/// Handler chain, the static Chain and the compiled PriceTable, then times
+/// GetAffordableMasks against a plain scalar loop. Prints the best of
+/// several runs. Run it with `make bench_chain`.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "chainOfResponsibility.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kRuns = 5;
+constexpr std::size_t kBudgets = 1'000'000;
+
+/// @brief Handler that only compares prices, so the walk prints nothing.
+class PriceCheck final : public ChainOfResponsibility::Handler {
+ public:
+  explicit PriceCheck(int price) : Handler(price) {}
+
+  std::string GetName() const override { return "item"; }
+
+  bool Handle(int money) const override { return HaveEnoughtMoney(money); }
+};
+
+/* Chain<PriceCheck, ..., PriceCheck> with N handlers */
+template <typename Indices>
+struct StaticChainOf;
+
+template <std::size_t... Idx>
+struct StaticChainOf<std::index_sequence<Idx...>> {
+  template <std::size_t>
+  using Item = PriceCheck;
+
+  using Type = ChainOfResponsibility::Chain<Item<Idx>...>;
+
+  static Type Make(const std::vector<int>& prices) {
+    return Type(prices[Idx]...);
+  }
+};
+
+/* Best time of kRuns calls, in nanoseconds per budget */
+template <typename Run>
+double BestNsPerBudget(Run run) {
+  double best = 0;
+  for (int i = 0; i < kRuns; ++i) {
+    const auto start = Clock::now();
+    run();
+    const std::chrono::duration<double, std::nano> elapsed =
+        Clock::now() - start;
+    const double ns = elapsed.count() / static_cast<double>(kBudgets);
+    best = i == 0 ? ns : std::min(best, ns);
+  }
+  return best;
+}
+
+void Print(const char* what, double ns, double baseline) {
+  std::cout << std::fixed << std::setprecision(2) << "  " << std::left
+            << std::setw(28) << what << std::right << std::setw(8) << ns
+            << " ns" << std::setw(9) << baseline / ns << "x\n";
+}
+
+template <std::size_t N>
+bool Bench(const std::vector<int>& budgets) {
+  std::vector<int> prices;
+  for (std::size_t i = 0; i < N; ++i) {
+    prices.push_back(static_cast<int>(100 + (i * 37) % N * 100));
+  }
+
+  std::unique_ptr<ChainOfResponsibility::Handler> chain;
+  for (std::size_t i = N; i-- > 0;) {
+    auto handler = std::make_unique<PriceCheck>(prices[i]);
+    handler->SetNext(std::move(chain));
+    chain = std::move(handler);
+  }
+  const auto staticChain =
+      StaticChainOf<std::make_index_sequence<N>>::Make(prices);
+  const auto table = ChainOfResponsibility::PriceTable::Compile(*chain);
+
+  /* every way must count the same customers */
+  std::size_t dynamicCount = 0;
+  std::size_t staticCount = 0;
+  std::size_t tableCount = 0;
+  std::uint64_t scalarBits = 0;
+  std::uint64_t simdBits = 0;
+  std::vector<std::uint32_t> masks(budgets.size());
+
+  const double dynamicNs = BestNsPerBudget([&] {
+    dynamicCount = 0;
+    for (int money : budgets) dynamicCount += chain->Process(money) != nullptr;
+  });
+  const double staticNs = BestNsPerBudget([&] {
+    staticCount = 0;
+    for (int money : budgets) staticCount += staticChain.Process(money);
+  });
+  const double tableNs = BestNsPerBudget([&] {
+    tableCount = 0;
+    for (int money : budgets) tableCount += table.CountAffordable(money) > 0;
+  });
+  const double scalarNs = BestNsPerBudget([&] {
+    for (std::size_t j = 0; j < budgets.size(); ++j) {
+      std::uint32_t mask = 0;
+      for (std::size_t i = 0; i < table.GetSize(); ++i) {
+        if (budgets[j] >= table.GetPrice(i)) mask |= std::uint32_t{1} << i;
+      }
+      masks[j] = mask;
+    }
+  });
+  for (std::uint32_t mask : masks) scalarBits += mask;
+  const double simdNs = BestNsPerBudget(
+      [&] { table.GetAffordableMasks(budgets, masks); });
+  for (std::uint32_t mask : masks) simdBits += mask;
+
+  std::cout << N << " items, " << budgets.size() << " budgets:\n";
+  Print("Handler::Process (virtual)", dynamicNs, dynamicNs);
+  Print("Chain::Process (static)", staticNs, dynamicNs);
+  Print("PriceTable::CountAffordable", tableNs, dynamicNs);
+  Print("masks, scalar loop", scalarNs, scalarNs);
+  Print("GetAffordableMasks (SIMD)", simdNs, scalarNs);
+
+  return dynamicCount == staticCount && dynamicCount == tableCount &&
+         scalarBits == simdBits;
+}
+
+}  // namespace
+
+int main() {
+  /* fixed seed: every run answers the same budgets */
+  std::mt19937 random(42);
+  std::uniform_int_distribution<int> money(0, 2000);
+  std::vector<int> budgets(kBudgets);
+  for (int& budget : budgets) budget = money(random);
+
+  std::cout << "best of " << kRuns << " runs, time per budget, speedup over "
+            << "the first line of each group\n\n";
+
+  bool ok = Bench<4>(budgets);
+  std::cout << '\n';
+  ok &= Bench<16>(budgets);
+
+  if (!ok) std::cerr << "FAILED: the answers differ\n";
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,9 +1,22 @@
 #ifndef __CHAIN_OF_RESPONSIBILITY
 #define __CHAIN_OF_RESPONSIBILITY
 
+/* x86 builds get SIMD kernels; AVX2 is picked at run time (see PriceTable) */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHAIN_OF_RESPONSIBILITY_X86
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "../../iPattern.h"
@@ -16,21 +29,48 @@ class Handler {
  public:
   explicit Handler(int price) : m_price(price) {}
 
-  virtual ~Handler() noexcept = default;
+  /* Unlinks the tail one handler at a time. The default destructor would
+   * recurse through the whole chain of unique_ptrs */
+  virtual ~Handler() noexcept {
+    std::unique_ptr<Handler> next = std::move(m_nextHandler);
+    while (next) next = std::move(next->m_nextHandler);
+  }
 
   void SetNext(std::unique_ptr<Handler> next) {
     m_nextHandler = std::move(next);
   }
 
-  /* Chilnder should override this method */
-  virtual void Process(int money) const = 0;
-
- protected:
-  /* pass to the next handler */
-  void PassOn(int money) const {
-    if (m_nextHandler) m_nextHandler->Process(money);
+  /* Passes the request along the chain, starting from this handler.
+   * This is a loop, not recursion, so a chain of any length fits on the
+   * stack. Returns the first handler that accepted the request (or nullptr);
+   * with stopAtFirstAccept the walk ends there */
+  const Handler* Process(int money, bool stopAtFirstAccept = false) const {
+    const Handler* accepted = nullptr;
+    for (const Handler* handler = this; handler;
+         handler = handler->m_nextHandler.get()) {
+      if (handler->Handle(money) && !accepted) {
+        accepted = handler;
+        if (stopAtFirstAccept) break;
+      }
+    }
+    return accepted;
   }
 
+  /* Chilnder should override this method.
+   * Handles the request by this handler only, returns true if accepted */
+  virtual bool Handle(int money) const = 0;
+
+  /* Name of the menu item */
+  virtual std::string GetName() const = 0;
+
+  /* Items that are not on the menu can never be bought */
+  virtual bool IsOnMenu() const { return true; }
+
+  int GetPrice() const { return m_price; }
+
+  const Handler* GetNext() const { return m_nextHandler.get(); }
+
+ protected:
   bool HaveEnoughtMoney(int money) const { return money >= m_price; }
 
   void PrintMoney(int money) const {
@@ -42,81 +82,86 @@ class Handler {
 };
 
 /* Concrete Handler 1: Ramen */
-class Ramen : public Handler {
+class Ramen final : public Handler {
  public:
   explicit Ramen(int price) : Handler(price) {}
 
-  void Process(int money) const override {
+  std::string GetName() const override { return "ramen"; }
+
+  bool Handle(int money) const override {
     std::cout << PrinterState::PlainText;
     PrintMoney(money);
 
     /* handle */
     if (HaveEnoughtMoney(money)) {
       std::cout << "You can buy ramen\n";
-    } else {
-      std::cout << "You can NOT buy ramen\n";
+      return true;
     }
 
-    /* next */
-    PassOn(money);
+    std::cout << "You can NOT buy ramen\n";
+    return false;
   }
 };
 
 /* Concrete Handler 2: Gyoza */
-class Gyoza : public Handler {
+class Gyoza final : public Handler {
  public:
   explicit Gyoza(int price) : Handler(price) {}
 
-  void Process(int money) const override {
+  std::string GetName() const override { return "gyoza"; }
+
+  bool Handle(int money) const override {
     std::cout << PrinterState::PlainText;
     PrintMoney(money);
 
     /* handle */
     if (HaveEnoughtMoney(money)) {
       std::cout << "You can buy gyoza\n";
-    } else {
-      std::cout << "You can NOT buy gyoza\n";
+      return true;
     }
 
-    /* next */
-    PassOn(money);
+    std::cout << "You can NOT buy gyoza\n";
+    return false;
   }
 };
 
 /* Concrete Handler 3: Udon */
-class Udon : public Handler {
+class Udon final : public Handler {
  public:
   explicit Udon(int price) : Handler(price) {}
 
-  void Process(int money) const override {
+  std::string GetName() const override { return "udon"; }
+
+  bool IsOnMenu() const override { return false; }
+
+  bool Handle(int /* money */) const override {
     /* handle */
     std::cout << PrinterState::PlainText
               << "You can NOT buy udon. We don't have it. "
               << "This is a ramen restaurant.\n";
-
-    /* next */
-    PassOn(money);
+    return false;
   }
 };
 
 /* Concrete Handler 4: Beer */
-class Beer : public Handler {
+class Beer final : public Handler {
  public:
   explicit Beer(int price) : Handler(price) {}
 
-  void Process(int money) const override {
+  std::string GetName() const override { return "beer"; }
+
+  bool Handle(int money) const override {
     std::cout << PrinterState::PlainText;
     PrintMoney(money);
 
     /* handle */
     if (HaveEnoughtMoney(money)) {
       std::cout << "You can buy beer\n";
-    } else {
-      std::cout << "You can NOT buy beer\n";
+      return true;
     }
 
-    /* next */
-    PassOn(money);
+    std::cout << "You can NOT buy beer\n";
+    return false;
   }
 };
 
@@ -142,6 +187,164 @@ class MenuBuilder {
   }
 };
 
+/* Chain fixed at compile time: Chain<Ramen, Gyoza, Beer, Udon>.
+ * The handlers are stored by value in a tuple and called by their concrete
+ * (final) types, so there are no virtual calls, no heap nodes and the whole
+ * chain can be inlined. Use it when the menu is known at build time */
+template <typename... Handlers>
+class Chain {
+ public:
+  template <typename>
+  using Price = int;
+
+  explicit Chain(Price<Handlers>... prices) : m_handlers(prices...) {}
+
+  /* Walks the chain like Handler::Process, with the same stopAtFirstAccept
+   * rule. The handlers have different types, so there is no handler to
+   * return: the result is true if any handler accepted the request */
+  bool Process(int money, bool stopAtFirstAccept = false) const {
+    return ProcessFrom(money, stopAtFirstAccept, false,
+                       std::integral_constant<std::size_t, 0>{});
+  }
+
+ private:
+  using End = std::integral_constant<std::size_t, sizeof...(Handlers)>;
+
+  bool ProcessFrom(int /* money */, bool /* stop */, bool accepted,
+                   End /* idx */) const {
+    return accepted;
+  }
+
+  template <std::size_t Idx>
+  bool ProcessFrom(int money, bool stop, bool accepted,
+                   std::integral_constant<std::size_t, Idx> /* idx */) const {
+    const bool handled = std::get<Idx>(m_handlers).Handle(money);
+    if (handled && stop) return true;
+    return ProcessFrom(money, stop, accepted || handled,
+                       std::integral_constant<std::size_t, Idx + 1>{});
+  }
+
+  std::tuple<Handlers...> m_handlers;
+};
+
+/* The menu from MenuBuilder as a static chain:
+ * StaticMenu menu(1000, 500, 750, 1200); */
+using StaticMenu = Chain<Ramen, Gyoza, Beer, Udon>;
+
+/* Compiled form of a chain: the items you can buy, sorted by price.
+ * Answers "what can I afford" with a binary search instead of a walk over
+ * the whole chain. The affordable items are always the first
+ * CountAffordable(money) entries of the table */
+class PriceTable {
+ public:
+  static PriceTable Compile(const Handler& chain) {
+    std::vector<std::pair<int, std::string>> items;
+    for (const Handler* handler = &chain; handler;
+         handler = handler->GetNext()) {
+      if (handler->IsOnMenu()) {
+        items.emplace_back(handler->GetPrice(), handler->GetName());
+      }
+    }
+    std::stable_sort(
+        items.begin(), items.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+    PriceTable table;
+    for (auto& item : items) {
+      table.m_prices.push_back(item.first);
+      table.m_names.push_back(std::move(item.second));
+    }
+    return table;
+  }
+
+  /* Same rule as Handler::HaveEnoughtMoney: money >= price */
+  std::size_t CountAffordable(int money) const {
+    return static_cast<std::size_t>(
+        std::upper_bound(m_prices.begin(), m_prices.end(), money) -
+        m_prices.begin());
+  }
+
+  /* Batch query for many customers at once.
+   * masks[j] gets bit i set if budgets[j] can buy the i-th item of the
+   * table. Every price is compared against 8 (AVX2) or 4 (SSE2) budgets at
+   * a time; the scalar loop handles the rest. AVX2 is used when the CPU
+   * has it, whatever flags the program was compiled with */
+  void GetAffordableMasks(std::span<const int> budgets,
+                          std::span<std::uint32_t> masks) const {
+    if (m_prices.size() > 32) {
+      throw std::runtime_error("Too many items for a 32-bit mask");
+    }
+    if (masks.size() < budgets.size()) {
+      throw std::runtime_error("Not enough room for the masks");
+    }
+
+    std::size_t j = 0;
+#if defined(CHAIN_OF_RESPONSIBILITY_X86)
+    if (HasAvx2()) j = MasksAvx2(budgets, masks);
+#endif
+#if defined(__SSE2__)
+    for (; j + 4 <= budgets.size(); j += 4) {
+      const __m128i money =
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(&budgets[j]));
+      __m128i mask = _mm_setzero_si128();
+      for (std::size_t i = 0; i < m_prices.size(); ++i) {
+        /* money >= price is !(price > money) */
+        const __m128i tooExpensive =
+            _mm_cmpgt_epi32(_mm_set1_epi32(m_prices[i]), money);
+        const __m128i bit = _mm_set1_epi32(static_cast<int>(1u << i));
+        mask = _mm_or_si128(mask, _mm_andnot_si128(tooExpensive, bit));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&masks[j]), mask);
+    }
+#endif
+    for (; j < budgets.size(); ++j) {
+      std::uint32_t mask = 0;
+      for (std::size_t i = 0; i < m_prices.size(); ++i) {
+        if (budgets[j] >= m_prices[i]) mask |= std::uint32_t{1} << i;
+      }
+      masks[j] = mask;
+    }
+  }
+
+  std::size_t GetSize() const { return m_prices.size(); }
+
+  int GetPrice(std::size_t idx) const { return m_prices[idx]; }
+
+  const std::string& GetName(std::size_t idx) const { return m_names[idx]; }
+
+ private:
+#if defined(CHAIN_OF_RESPONSIBILITY_X86)
+  static bool HasAvx2() {
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    return hasAvx2;
+  }
+
+  /* Compiled for AVX2 even if the rest of the program is not, only called
+   * after HasAvx2(). Returns how many budgets it handled */
+  __attribute__((target("avx2"))) std::size_t MasksAvx2(
+      std::span<const int> budgets, std::span<std::uint32_t> masks) const {
+    std::size_t j = 0;
+    for (; j + 8 <= budgets.size(); j += 8) {
+      const __m256i money =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&budgets[j]));
+      __m256i mask = _mm256_setzero_si256();
+      for (std::size_t i = 0; i < m_prices.size(); ++i) {
+        const __m256i tooExpensive =
+            _mm256_cmpgt_epi32(_mm256_set1_epi32(m_prices[i]), money);
+        const __m256i bit = _mm256_set1_epi32(static_cast<int>(1u << i));
+        mask = _mm256_or_si256(mask, _mm256_andnot_si256(tooExpensive, bit));
+      }
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(&masks[j]), mask);
+    }
+    return j;
+  }
+#endif
+
+  /* prices and names are kept apart, so the search only touches prices */
+  std::vector<int> m_prices;
+  std::vector<std::string> m_names;
+};
+
 /* Chain of Responsibility */
 class Pattern : public IPattern {
  public:
@@ -0,0 +1,61 @@
+/// @file longChainStress.cpp
+/// @brief Stress check for very long handler chains.
+///
+/// Builds a chain of a million handlers, walks it and destroys it. Run it
+/// with a small stack (`make stress` uses `ulimit -s 256`): any recursion
+/// over the chain, in Process or in the destructor, crashes the program.
+
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "chainOfResponsibility.h"
+
+namespace {
+
+constexpr int kHandlers = 1'000'000;
+
+/// @brief Handler that only compares prices, so the walk prints nothing.
+class PriceCheck final : public ChainOfResponsibility::Handler {
+ public:
+  explicit PriceCheck(int price) : Handler(price) {}
+
+  std::string GetName() const override { return "item"; }
+
+  bool Handle(int money) const override { return HaveEnoughtMoney(money); }
+};
+
+bool Check(bool ok, const char* what) {
+  if (!ok) std::cerr << "FAILED: " << what << '\n';
+  return ok;
+}
+
+}  // namespace
+
+int main() {
+  /* prices go down along the chain: only the tail is affordable */
+  std::unique_ptr<ChainOfResponsibility::Handler> chain;
+  for (int i = 0; i < kHandlers; ++i) {
+    auto handler = std::make_unique<PriceCheck>(i + 1);
+    handler->SetNext(std::move(chain));
+    chain = std::move(handler);
+  }
+
+  bool ok = true;
+  const ChainOfResponsibility::Handler* first = chain->Process(10);
+  ok &= Check(first && first->GetPrice() == 10, "first accepting handler");
+  ok &= Check(chain->Process(0) == nullptr, "nobody accepts");
+  ok &= Check(chain->Process(kHandlers, true) == chain.get(),
+              "stop at the first accepting handler");
+
+  const auto table = ChainOfResponsibility::PriceTable::Compile(*chain);
+  ok &= Check(table.GetSize() == kHandlers, "compiled table size");
+  ok &= Check(table.CountAffordable(10) == 10, "affordable items");
+
+  chain.reset();
+
+  std::cout << (ok ? "OK" : "FAILED") << ": chain of " << kHandlers
+            << " handlers\n";
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
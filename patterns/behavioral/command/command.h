@@ -1,12 +1,20 @@
 #ifndef __COMMAND_H__
 #define __COMMAND_H__
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <stack>
 #include <string>
+#include <vector>
 
 #include "../../iPattern.h"
+#include "commandJournal.h"
 
 /* GoF design pattern: Command */
 namespace Command {
@@ -29,6 +37,7 @@ class ICommand {
   virtual ~ICommand() noexcept = default;
   virtual void Execute() const = 0;
   virtual void Undo() const = 0;
+  virtual CommandType GetType() const = 0;
 };
 
 /* Concrete Command: cook ramen */
@@ -41,6 +50,8 @@ class CommandCookRamen : public ICommand {
 
   void Undo() const override { m_chef->StopCooking(m_meal); }
 
+  CommandType GetType() const override { return CommandType::CookRamen; }
+
  private:
   std::shared_ptr<ReceiverChef> m_chef;
   const std::string m_meal;
@@ -56,6 +67,8 @@ class CommandCookGyoza : public ICommand {
 
   void Undo() const override { m_chef->StopCooking(m_meal); }
 
+  CommandType GetType() const override { return CommandType::CookGyoza; }
+
  private:
   std::shared_ptr<ReceiverChef> m_chef;
   const std::string m_meal;
@@ -80,25 +93,249 @@ class CommandHistory {
   std::stack<std::unique_ptr<ICommand>> m_history;
 };
 
+/* Priority classes of orders. Lower value is served first */
+enum class Priority : std::uint8_t { Vip = 0, Bonus = 1, Regular = 2 };
+
+/* Queueing latency of one priority class: from Submit to the start of
+ * Execute. The histogram uses power-of-two microsecond buckets, which is
+ * enough to see the tail without storing every sample */
+class LatencyStats {
+ public:
+  static constexpr std::size_t kBuckets = 32;
+
+  void Record(std::chrono::nanoseconds latency, bool missedDeadline) {
+    const auto us = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+    std::size_t bucket = 0;
+    while (bucket + 1 < kBuckets && (std::uint64_t{1} << bucket) <= us) {
+      ++bucket;
+    }
+
+    ++m_histogram[bucket];
+    ++m_count;
+    m_total += latency;
+    m_max = std::max(m_max, latency);
+    if (missedDeadline) ++m_missedDeadlines;
+  }
+
+  std::size_t GetCount() const { return m_count; }
+  std::size_t GetMissedDeadlines() const { return m_missedDeadlines; }
+  std::chrono::nanoseconds GetMax() const { return m_max; }
+
+  std::chrono::nanoseconds GetMean() const {
+    return m_count == 0 ? std::chrono::nanoseconds{0}
+                        : m_total / static_cast<std::int64_t>(m_count);
+  }
+
+  /* Upper bound of the bucket that holds the given percentile (0..100) */
+  std::chrono::microseconds GetPercentile(double percentile) const {
+    const auto rank = static_cast<std::size_t>(
+        std::ceil(percentile / 100.0 * static_cast<double>(m_count)));
+    std::size_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i) {
+      seen += m_histogram[i];
+      if (seen >= rank && seen > 0) {
+        return std::chrono::microseconds{std::int64_t{1} << i};
+      }
+    }
+    return std::chrono::microseconds{0};
+  }
+
+ private:
+  std::array<std::size_t, kBuckets> m_histogram{};
+  std::size_t m_count = 0;
+  std::size_t m_missedDeadlines = 0;
+  std::chrono::nanoseconds m_total{0};
+  std::chrono::nanoseconds m_max{0};
+};
+
+/* Scheduler in front of the chef.
+ * Orders are served by priority class first (VIP before bonus before
+ * regular), and by the earliest deadline inside a class. Each class has its
+ * own binary heap, so Submit and RunNext are O(log n). Under overload lower
+ * classes wait, which keeps the tail latency of high-priority orders low.
+ *
+ * Strict priorities can starve the regular class for as long as VIP orders
+ * keep coming. With an aging limit, an order that is that late past its
+ * deadline is served before any class above it.
+ */
+class KitchenScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  /* Called with the command once it has been executed */
+  using OnExecuted = std::function<void(std::unique_ptr<ICommand>)>;
+
+  KitchenScheduler() = default;
+
+  explicit KitchenScheduler(Clock::duration agingLimit)
+      : m_agingLimit(agingLimit) {}
+
+  void Submit(std::unique_ptr<ICommand> cmd, Priority priority,
+              Clock::duration timeToDeadline, OnExecuted onExecuted = {}) {
+    const auto now = Clock::now();
+    auto& queue = m_queues[static_cast<std::size_t>(priority)];
+    queue.push_back(Order{std::move(cmd), std::move(onExecuted), now,
+                          now + timeToDeadline, m_nextSeq++});
+    std::push_heap(queue.begin(), queue.end(), LaterFirst);
+  }
+
+  /* Executes the most urgent order. Returns false if nothing is pending */
+  bool RunNext() {
+    const auto start = Clock::now();
+    const std::size_t cls = PickClass(start);
+    if (cls == kClasses) return false;
+
+    auto& queue = m_queues[cls];
+    std::pop_heap(queue.begin(), queue.end(), LaterFirst);
+    Order order = std::move(queue.back());
+    queue.pop_back();
+
+    m_stats[cls].Record(start - order.submitted, start > order.deadline);
+    order.cmd->Execute();
+    if (order.onExecuted) order.onExecuted(std::move(order.cmd));
+    return true;
+  }
+
+  /* Executes everything that is pending. Returns the number of orders */
+  std::size_t RunAll() {
+    std::size_t count = 0;
+    while (RunNext()) ++count;
+    return count;
+  }
+
+  std::size_t GetPending() const {
+    std::size_t count = 0;
+    for (const auto& queue : m_queues) count += queue.size();
+    return count;
+  }
+
+  const LatencyStats& GetStats(Priority priority) const {
+    return m_stats[static_cast<std::size_t>(priority)];
+  }
+
+ private:
+  static constexpr std::size_t kClasses = 3;
+
+  struct Order {
+    std::unique_ptr<ICommand> cmd;
+    OnExecuted onExecuted;
+    Clock::time_point submitted;
+    Clock::time_point deadline;
+    std::uint64_t seq;
+  };
+
+  /* heap comparator: the earliest deadline (then the oldest order) on top */
+  static bool LaterFirst(const Order& lhs, const Order& rhs) {
+    if (lhs.deadline != rhs.deadline) return lhs.deadline > rhs.deadline;
+    return lhs.seq > rhs.seq;
+  }
+
+  /* The highest non-empty class, unless a lower class has an order that is
+   * more than the aging limit past its deadline. The top of a heap is its
+   * earliest deadline, so only one order per class is looked at */
+  std::size_t PickClass(Clock::time_point now) const {
+    std::size_t pick = kClasses;
+    for (std::size_t cls = 0; cls < kClasses; ++cls) {
+      const auto& queue = m_queues[cls];
+      if (queue.empty()) continue;
+      if (pick == kClasses) {
+        pick = cls;
+      } else if (now - queue.front().deadline >= m_agingLimit) {
+        return cls;
+      }
+    }
+    return pick;
+  }
+
+  std::array<std::vector<Order>, kClasses> m_queues;
+  std::array<LatencyStats, kClasses> m_stats;
+  Clock::duration m_agingLimit = Clock::duration::max();
+  std::uint64_t m_nextSeq = 0;
+};
+
 /* Invoker */
 class Waiter {
  public:
   Waiter() : m_chef(std::make_shared<ReceiverChef>()) {}
 
-  void OrderRamen() { Execute(std::make_unique<CommandCookRamen>(m_chef)); }
+  /* The waiter writes every order to the journal and restores the history
+   * from it, so orders and undo records survive a restart.
+   * Recovered commands are not cooked again. */
+  explicit Waiter(std::unique_ptr<CommandJournal> journal)
+      : Waiter(nullptr, std::move(journal)) {}
+
+  /* Orders go through the scheduler instead of being cooked right away.
+   * An order enters the history and the journal when the scheduler executes
+   * it, so the waiter must outlive the orders it has submitted */
+  explicit Waiter(KitchenScheduler& scheduler,
+                  std::unique_ptr<CommandJournal> journal = nullptr)
+      : Waiter(&scheduler, std::move(journal)) {}
+
+  Waiter(const Waiter&) = delete;
+  Waiter& operator=(const Waiter&) = delete;
+
+  void OrderRamen(Priority priority = Priority::Regular,
+                  KitchenScheduler::Clock::duration timeToDeadline = {}) {
+    Order(MakeCommand(CommandType::CookRamen), priority, timeToDeadline);
+  }
 
-  void OrderGyoza() { Execute(std::make_unique<CommandCookGyoza>(m_chef)); }
+  void OrderGyoza(Priority priority = Priority::Regular,
+                  KitchenScheduler::Clock::duration timeToDeadline = {}) {
+    Order(MakeCommand(CommandType::CookGyoza), priority, timeToDeadline);
+  }
 
-  void CancelLastOrder() { m_history.Pop()->Undo(); }
+  /* Undoes the last executed order. Orders still waiting in the scheduler
+   * are not in the history yet */
+  void CancelLastOrder() {
+    auto cmd = m_history.Pop();
+    cmd->Undo();
+    if (m_journal) m_journal->Append(JournalOp::Undone, cmd->GetType());
+  }
 
  private:
-  void Execute(std::unique_ptr<ICommand> cmd) {
+  Waiter(KitchenScheduler* scheduler, std::unique_ptr<CommandJournal> journal)
+      : m_chef(std::make_shared<ReceiverChef>()),
+        m_journal(std::move(journal)),
+        m_scheduler(scheduler) {
+    if (!m_journal) return;
+    for (CommandType type : m_journal->Recover()) {
+      m_history.Push(MakeCommand(type));
+    }
+  }
+
+  /* Priority and deadline only matter when there is a scheduler */
+  void Order(std::unique_ptr<ICommand> cmd, Priority priority,
+             KitchenScheduler::Clock::duration timeToDeadline) {
+    if (m_scheduler) {
+      m_scheduler->Submit(
+          std::move(cmd), priority, timeToDeadline,
+          [this](std::unique_ptr<ICommand> done) { Record(std::move(done)); });
+      return;
+    }
     cmd->Execute();
+    Record(std::move(cmd));
+  }
+
+  void Record(std::unique_ptr<ICommand> cmd) {
+    if (m_journal) m_journal->Append(JournalOp::Executed, cmd->GetType());
     m_history.Push(std::move(cmd));
   }
 
+  std::unique_ptr<ICommand> MakeCommand(CommandType type) const {
+    switch (type) {
+      case CommandType::CookRamen:
+        return std::make_unique<CommandCookRamen>(m_chef);
+      case CommandType::CookGyoza:
+        return std::make_unique<CommandCookGyoza>(m_chef);
+    }
+    throw std::runtime_error("Unknown command type");
+  }
+
  private:
   std::shared_ptr<ReceiverChef> m_chef;
+  std::unique_ptr<CommandJournal> m_journal;
+  KitchenScheduler* m_scheduler = nullptr;
   CommandHistory m_history;
 };
 
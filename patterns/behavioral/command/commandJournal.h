@@ -0,0 +1,332 @@
+#ifndef __COMMAND_JOURNAL_H__
+#define __COMMAND_JOURNAL_H__
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Command {
+
+/* Kinds of commands the waiter can take. Stored in the journal as one byte */
+enum class CommandType : std::uint8_t { CookRamen = 0, CookGyoza = 1 };
+
+/* What happened to a command */
+enum class JournalOp : std::uint8_t { Executed = 0, Undone = 1 };
+
+/* Append-only binary journal of executed and undone commands.
+ *
+ * Appending a record is a memcpy into an in-memory buffer. The buffer is
+ * written out with one write + fdatasync when `groupSize` records are pending
+ * (group commit), so only every n-th order pays for the disk. Records that
+ * are not synced yet are lost on a crash; call Sync() when an order must be
+ * durable right now.
+ *
+ * Every `checkpointEvery` records the live command stack is saved to
+ * "<path>.ckpt" and the log is truncated, so replay time stays bounded.
+ *
+ * Recover() must be called before the first Append() or Checkpoint(): it
+ * restores the sequence number and the live stack that new records and
+ * checkpoints build on.
+ */
+class CommandJournal {
+ public:
+  explicit CommandJournal(std::string path, std::size_t groupSize = 64,
+                          std::size_t checkpointEvery = 4096)
+      : m_path(std::move(path)),
+        m_groupSize(groupSize == 0 ? 1 : groupSize),
+        m_checkpointEvery(checkpointEvery) {
+    m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (m_fd < 0) Fail("cannot open journal " + m_path);
+    m_buffer.reserve(m_groupSize * sizeof(Record));
+  }
+
+  CommandJournal(const CommandJournal&) = delete;
+  CommandJournal& operator=(const CommandJournal&) = delete;
+
+  ~CommandJournal() noexcept {
+    try {
+      Sync();
+    } catch (...) {
+      /* nothing we can do in a destructor */
+    }
+    ::close(m_fd);
+  }
+
+  /* Loads the checkpoint and replays the log on top of it.
+   * Returns the command stack, bottom first. A torn record at the end of the
+   * log (crash in the middle of a write) is dropped.
+   */
+  std::vector<CommandType> Recover() {
+    m_live.clear();
+    m_seq = LoadCheckpoint(m_live);
+
+    std::size_t validSize = 0;
+    {
+      MappedFile log(m_fd);
+      const std::size_t count = log.Size() / sizeof(Record);
+      for (std::size_t i = 0; i < count; ++i) {
+        Record rec;
+        std::memcpy(&rec, log.Data() + i * sizeof(Record), sizeof(Record));
+        if (!IsValid(rec)) break;
+
+        validSize += sizeof(Record);
+        if (rec.seq <= m_seq) continue; /* already in the checkpoint */
+
+        Apply(rec.op, rec.type);
+        m_seq = rec.seq;
+        ++m_sinceCheckpoint;
+      }
+    }
+
+    if (::ftruncate(m_fd, static_cast<off_t>(validSize)) != 0) {
+      Fail("cannot truncate journal " + m_path);
+    }
+    m_recovered = true;
+    return m_live;
+  }
+
+  /* Records an executed or undone command */
+  void Append(JournalOp op, CommandType type) {
+    CheckRecovered();
+
+    Record rec{};
+    rec.magic = kRecordMagic;
+    rec.op = op;
+    rec.type = type;
+    rec.seq = ++m_seq;
+    rec.checksum = Checksum(&rec, offsetof(Record, checksum));
+
+    const auto* bytes = reinterpret_cast<const char*>(&rec);
+    m_buffer.insert(m_buffer.end(), bytes, bytes + sizeof(Record));
+    Apply(op, type);
+
+    if (m_checkpointEvery != 0 && ++m_sinceCheckpoint >= m_checkpointEvery) {
+      Checkpoint();
+    } else if (m_buffer.size() >= m_groupSize * sizeof(Record)) {
+      Sync();
+    }
+  }
+
+  /* Writes pending records and waits until they reach the disk */
+  void Sync() {
+    if (m_buffer.empty()) return;
+
+    WriteAll(m_fd, m_buffer.data(), m_buffer.size());
+    if (::fdatasync(m_fd) != 0) Fail("cannot sync journal " + m_path);
+    m_buffer.clear();
+  }
+
+  /* Saves the live command stack and truncates the log.
+   * The checkpoint is written to a temporary file and renamed, so a crash
+   * leaves either the old or the new one. Log records with a sequence number
+   * covered by the checkpoint are skipped on replay.
+   */
+  void Checkpoint() {
+    CheckRecovered();
+
+    const std::string tmpPath = CheckpointPath() + ".tmp";
+
+    std::vector<char> data(sizeof(CheckpointHeader) + m_live.size() +
+                           sizeof(std::uint32_t));
+    CheckpointHeader header{};
+    header.magic = kCheckpointMagic;
+    header.count = static_cast<std::uint32_t>(m_live.size());
+    header.seq = m_seq;
+    std::memcpy(data.data(), &header, sizeof(header));
+    if (!m_live.empty()) {
+      std::memcpy(data.data() + sizeof(header), m_live.data(), m_live.size());
+    }
+    const std::uint32_t checksum =
+        Checksum(data.data(), data.size() - sizeof(std::uint32_t));
+    std::memcpy(data.data() + data.size() - sizeof(checksum), &checksum,
+                sizeof(checksum));
+
+    const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) Fail("cannot create checkpoint " + tmpPath);
+    try {
+      WriteAll(fd, data.data(), data.size());
+      if (::fsync(fd) != 0) Fail("cannot sync checkpoint " + tmpPath);
+    } catch (...) {
+      ::close(fd);
+      throw;
+    }
+    ::close(fd);
+
+    if (::rename(tmpPath.c_str(), CheckpointPath().c_str()) != 0) {
+      Fail("cannot rename checkpoint " + tmpPath);
+    }
+    /* the rename must be on disk before the log is truncated */
+    SyncDirectory();
+
+    /* everything up to m_seq is in the checkpoint now */
+    m_buffer.clear();
+    if (::ftruncate(m_fd, 0) != 0) Fail("cannot truncate journal " + m_path);
+    m_sinceCheckpoint = 0;
+  }
+
+ private:
+  static constexpr std::uint32_t kRecordMagic = 0x4A524E4C;      // "JRNL"
+  static constexpr std::uint32_t kCheckpointMagic = 0x434B5054;  // "CKPT"
+
+  /* One log record. Fixed size, so the log is just an array of them */
+  struct Record {
+    std::uint32_t magic;
+    JournalOp op;
+    CommandType type;
+    std::uint16_t reserved;
+    std::uint64_t seq;
+    std::uint32_t checksum;
+    std::uint32_t padding;
+  };
+  static_assert(sizeof(Record) == 24, "Unexpected journal record size");
+
+  /* Checkpoint file: header, one byte per command, checksum */
+  struct CheckpointHeader {
+    std::uint32_t magic;
+    std::uint32_t count;
+    std::uint64_t seq;
+  };
+
+  /* Read-only mapping of a whole file */
+  class MappedFile {
+   public:
+    explicit MappedFile(int fd) {
+      struct stat st {};
+      if (::fstat(fd, &st) != 0 || st.st_size == 0) return;
+
+      m_size = static_cast<std::size_t>(st.st_size);
+      void* addr = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) Fail("cannot map journal");
+      m_data = static_cast<const char*>(addr);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() noexcept {
+      if (m_data) ::munmap(const_cast<char*>(m_data), m_size);
+    }
+
+    const char* Data() const { return m_data; }
+    std::size_t Size() const { return m_data ? m_size : 0; }
+
+   private:
+    const char* m_data = nullptr;
+    std::size_t m_size = 0;
+  };
+
+  std::string CheckpointPath() const { return m_path + ".ckpt"; }
+
+  void CheckRecovered() const {
+    if (!m_recovered) {
+      throw std::runtime_error("Journal " + m_path + " is not recovered");
+    }
+  }
+
+  /* Makes renames in the journal's directory durable */
+  void SyncDirectory() const {
+    const std::size_t slash = m_path.rfind('/');
+    std::string dir = ".";
+    if (slash != std::string::npos) dir = m_path.substr(0, slash ? slash : 1);
+    const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) Fail("cannot open directory " + dir);
+    const int result = ::fsync(fd);
+    ::close(fd);
+    if (result != 0) Fail("cannot sync directory " + dir);
+  }
+
+  /* Reads the checkpoint into `live`. Returns its sequence number */
+  std::uint64_t LoadCheckpoint(std::vector<CommandType>& live) const {
+    const int fd = ::open(CheckpointPath().c_str(), O_RDONLY);
+    if (fd < 0) return 0; /* no checkpoint yet */
+
+    MappedFile file(fd);
+    ::close(fd);
+
+    CheckpointHeader header{};
+    if (file.Size() < sizeof(header) + sizeof(std::uint32_t)) {
+      throw std::runtime_error("Corrupted checkpoint " + CheckpointPath());
+    }
+    std::memcpy(&header, file.Data(), sizeof(header));
+
+    const std::size_t bodySize = sizeof(header) + header.count;
+    std::uint32_t checksum = 0;
+    if (header.magic != kCheckpointMagic ||
+        file.Size() != bodySize + sizeof(checksum)) {
+      throw std::runtime_error("Corrupted checkpoint " + CheckpointPath());
+    }
+    std::memcpy(&checksum, file.Data() + bodySize, sizeof(checksum));
+    if (checksum != Checksum(file.Data(), bodySize)) {
+      throw std::runtime_error("Corrupted checkpoint " + CheckpointPath());
+    }
+
+    const auto* types =
+        reinterpret_cast<const CommandType*>(file.Data() + sizeof(header));
+    live.assign(types, types + header.count);
+    return header.seq;
+  }
+
+  static bool IsValid(const Record& rec) {
+    return rec.magic == kRecordMagic &&
+           rec.checksum == Checksum(&rec, offsetof(Record, checksum));
+  }
+
+  /* Keeps the live command stack in sync with the log */
+  void Apply(JournalOp op, CommandType type) {
+    if (op == JournalOp::Executed) {
+      m_live.push_back(type);
+    } else if (!m_live.empty()) {
+      m_live.pop_back();
+    }
+  }
+
+  /* FNV-1a */
+  static std::uint32_t Checksum(const void* data, std::size_t size) {
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    std::uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < size; ++i) {
+      hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+  }
+
+  static void WriteAll(int fd, const char* data, std::size_t size) {
+    while (size > 0) {
+      const ssize_t written = ::write(fd, data, size);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        Fail("cannot write journal");
+      }
+      data += written;
+      size -= static_cast<std::size_t>(written);
+    }
+  }
+
+  [[noreturn]] static void Fail(const std::string& what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+
+ private:
+  const std::string m_path;
+  const std::size_t m_groupSize;
+  const std::size_t m_checkpointEvery;
+  int m_fd = -1;
+  std::uint64_t m_seq = 0;
+  std::size_t m_sinceCheckpoint = 0;
+  bool m_recovered = false;
+  std::vector<char> m_buffer;
+  std::vector<CommandType> m_live;
+};
+
+}  // namespace Command
+
+#endif /* __COMMAND_JOURNAL_H__ */
@@ -1,9 +1,18 @@
 #ifndef __MEDIATOR_H__
 #define __MEDIATOR_H__
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "../../iPattern.h"
 
@@ -19,6 +28,11 @@ enum class Meal {
   Udon,
 };
 
+constexpr std::size_t kMealCount = static_cast<std::size_t>(Meal::Udon) + 1;
+
+/* Number of orders of each meal */
+using MealCounts = std::array<std::uint64_t, kMealCount>;
+
 std::ostream& operator<<(std::ostream& os, Meal meal) {
   switch (meal) {
     case Meal::MisoRamen:
@@ -55,6 +69,17 @@ class Restaurant {
     m_mediator = std::move(mediator);
   }
 
+  /* Someone ordered a meal this restaurant competes on */
+  virtual void OnCompetitorOrder(Meal /* meal */) {}
+
+  /* Competitors' orders over a window, only meals this restaurant competes
+   * on are non-zero. By default it is one OnCompetitorOrder per meal */
+  virtual void OnCompetitorSummary(const MealCounts& orders) {
+    for (std::size_t i = 0; i < kMealCount; ++i) {
+      if (orders[i] != 0) OnCompetitorOrder(static_cast<Meal>(i));
+    }
+  }
+
  protected:
   const std::string m_name;
   std::shared_ptr<IMediator> m_mediator;
@@ -82,6 +107,10 @@ class RamenRestaurant : public Restaurant {
    * The mediator will send a notification that someone has ordered another
    * meal. They should spend more money on ad.
    */
+  void OnCompetitorOrder(Meal /* meal */) override {
+    SuggestToIncreaseRamenAdvertisingBudget();
+  }
+
   void SuggestToIncreaseRamenAdvertisingBudget() {
     std::cout << PrinterState::PlainText << m_name
               << ": we should increase the ad budget.";
@@ -97,6 +126,10 @@ class UdonRestaurant : public Restaurant {
    * The mediator will send a notification that someone has ordered another
    * meal. They should spend more money on ad.
    */
+  void OnCompetitorOrder(Meal /* meal */) override {
+    SuggestToIncreaseUdonAdvertisingBudget();
+  }
+
   void SuggestToIncreaseUdonAdvertisingBudget() const {
     std::cout << PrinterState::PlainText << m_name
               << ": we should increase the ad budget.";
@@ -140,6 +173,233 @@ class AdAgencyMediator : public IMediator {
   std::shared_ptr<UdonRestaurant> m_udon;
 };
 
+/* Mediator for many restaurants.
+ * Each restaurant subscribes to the meals it competes on. The bus keeps an
+ * inverted index meal -> subscribers, so an order only reaches the
+ * restaurants that care about that meal instead of all of them.
+ * The bus does not own restaurants: unsubscribe one before destroying it.
+ */
+class AdBusMediator : public IMediator {
+ public:
+  using MealSet = std::bitset<kMealCount>;
+
+  void Subscribe(Restaurant& restaurant, MealSet meals) {
+    MealSet& interests = m_interests[&restaurant];
+    for (std::size_t i = 0; i < kMealCount; ++i) {
+      if (meals[i] && !interests[i]) m_subscribers[i].push_back(&restaurant);
+    }
+    interests |= meals;
+  }
+
+  void Subscribe(Restaurant& restaurant, std::initializer_list<Meal> meals) {
+    MealSet set;
+    for (Meal meal : meals) set.set(static_cast<std::size_t>(meal));
+    Subscribe(restaurant, set);
+  }
+
+  void Unsubscribe(Restaurant& restaurant) {
+    const auto it = m_interests.find(&restaurant);
+    if (it == m_interests.end()) return;
+
+    for (std::size_t i = 0; i < kMealCount; ++i) {
+      if (!it->second[i]) continue;
+      auto& subscribers = m_subscribers[i];
+      subscribers.erase(
+          std::find(subscribers.begin(), subscribers.end(), &restaurant));
+    }
+    m_interests.erase(it);
+  }
+
+  void Notify(const Restaurant* rest, Meal meal) override {
+    for (Restaurant* subscriber :
+         m_subscribers[static_cast<std::size_t>(meal)]) {
+      if (subscriber != rest) subscriber->OnCompetitorOrder(meal);
+    }
+  }
+
+ private:
+  /* meal -> restaurants competing on it */
+  std::array<std::vector<Restaurant*>, kMealCount> m_subscribers;
+  /* restaurant -> its meals, used to unsubscribe */
+  std::unordered_map<const Restaurant*, MealSet> m_interests;
+};
+
+/* Mediator that sends summaries instead of a message per order.
+ * Orders only bump per-restaurant atomic counters. Once per window (every
+ * `countWindow` orders or `timeWindow`, whichever comes first, or on an
+ * explicit Flush) each subscriber gets one OnCompetitorSummary with the
+ * orders of the others for the meals it competes on.
+ *
+ * There is no timer thread: the time window is checked when an order comes
+ * in. The orders of the last burst before a quiet period are only sent by
+ * the next order, so callers that use a time window must also call
+ * FlushIfExpired (or Flush) periodically, e.g. from their event loop.
+ *
+ * Notify may be called from many threads. Subscribe and Unsubscribe are
+ * not thread-safe: change subscriptions while no orders come in.
+ */
+class AggregatingMediator : public IMediator {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using MealSet = std::bitset<kMealCount>;
+
+  explicit AggregatingMediator(
+      std::uint64_t countWindow,
+      Clock::duration timeWindow = Clock::duration::zero())
+      : m_countWindow(countWindow),
+        m_timeWindow(timeWindow),
+        m_windowStart(Clock::now().time_since_epoch().count()) {}
+
+  /* Subscribing again adds meals to the restaurant's interests, like
+   * AdBusMediator does: a restaurant always has a single slot */
+  void Subscribe(Restaurant& restaurant, MealSet meals) {
+    const auto it = m_slotIdx.find(&restaurant);
+    if (it != m_slotIdx.end()) {
+      m_slots[it->second]->interests |= meals;
+      return;
+    }
+
+    auto slot = std::make_unique<Slot>();
+    slot->restaurant = &restaurant;
+    slot->interests = meals;
+    m_slots.push_back(std::move(slot));
+    m_slotIdx[&restaurant] = m_slots.size() - 1;
+  }
+
+  void Subscribe(Restaurant& restaurant, std::initializer_list<Meal> meals) {
+    MealSet set;
+    for (Meal meal : meals) set.set(static_cast<std::size_t>(meal));
+    Subscribe(restaurant, set);
+  }
+
+  /* The restaurant's orders of the current window still reach the others */
+  void Unsubscribe(Restaurant& restaurant) {
+    const auto it = m_slotIdx.find(&restaurant);
+    if (it == m_slotIdx.end()) return;
+
+    const std::size_t idx = it->second;
+    for (std::size_t i = 0; i < kMealCount; ++i) {
+      m_anonymous.orders[i].fetch_add(
+          m_slots[idx]->orders[i].load(std::memory_order_relaxed),
+          std::memory_order_relaxed);
+    }
+
+    /* the last slot takes the place of the removed one */
+    std::swap(m_slots[idx], m_slots.back());
+    m_slotIdx[m_slots[idx]->restaurant] = idx;
+    m_slots.pop_back();
+    m_slotIdx.erase(it);
+  }
+
+  /* Hot path: a relaxed atomic increment in the sender's own slot */
+  void Notify(const Restaurant* rest, Meal meal) override {
+    const auto it = m_slotIdx.find(rest);
+    Slot& slot = it == m_slotIdx.end() ? m_anonymous : *m_slots[it->second];
+    slot.orders[static_cast<std::size_t>(meal)].fetch_add(
+        1, std::memory_order_relaxed);
+
+    const std::uint64_t count =
+        m_orders.fetch_add(1, std::memory_order_relaxed) + 1;
+    if ((m_countWindow != 0 && count % m_countWindow == 0) ||
+        TimeWindowExpired()) {
+      Flush();
+    }
+  }
+
+  /* Sends the summaries for the current window and starts a new one.
+   * If another thread is flushing already, returns immediately and that
+   * thread flushes once more when it is done, so a trigger is never lost.
+   *
+   * The request flag and the flushing flag are sequentially consistent:
+   * either this thread sees the flush finished and takes it over, or the
+   * flushing thread sees the request when it lets go */
+  void Flush() {
+    m_flushRequested.store(true);
+    while (m_flushRequested.load()) {
+      if (m_flushing.exchange(true)) return;
+      FlushGuard guard(m_flushing);
+      if (m_flushRequested.exchange(false)) FlushWindow();
+    }
+  }
+
+  /* Flushes if the time window has expired. Returns true if it did */
+  bool FlushIfExpired() {
+    if (!TimeWindowExpired()) return false;
+    Flush();
+    return true;
+  }
+
+ private:
+  /* One per restaurant, on its own cache line so that restaurants ordering
+   * from different threads do not fight over it */
+  struct alignas(64) Slot {
+    std::array<std::atomic<std::uint64_t>, kMealCount> orders{};
+    Restaurant* restaurant = nullptr;
+    MealSet interests;
+  };
+
+  /* Ends a flush, even if a restaurant throws */
+  class FlushGuard {
+   public:
+    explicit FlushGuard(std::atomic<bool>& flushing) : m_flushing(flushing) {}
+    FlushGuard(const FlushGuard&) = delete;
+    FlushGuard& operator=(const FlushGuard&) = delete;
+    ~FlushGuard() { m_flushing.store(false); }
+
+   private:
+    std::atomic<bool>& m_flushing;
+  };
+
+  /* Called by one thread at a time */
+  void FlushWindow() {
+    m_windowStart.store(Clock::now().time_since_epoch().count(),
+                        std::memory_order_relaxed);
+
+    /* take the counters; orders that come in now go to the next window */
+    std::vector<MealCounts> own(m_slots.size());
+    MealCounts total{};
+    for (std::size_t s = 0; s <= m_slots.size(); ++s) {
+      Slot& slot = s < m_slots.size() ? *m_slots[s] : m_anonymous;
+      for (std::size_t i = 0; i < kMealCount; ++i) {
+        const std::uint64_t orders =
+            slot.orders[i].exchange(0, std::memory_order_relaxed);
+        total[i] += orders;
+        if (s < m_slots.size()) own[s][i] = orders;
+      }
+    }
+
+    for (std::size_t s = 0; s < m_slots.size(); ++s) {
+      MealCounts others{};
+      bool any = false;
+      for (std::size_t i = 0; i < kMealCount; ++i) {
+        if (!m_slots[s]->interests[i]) continue;
+        others[i] = total[i] - own[s][i];
+        any = any || others[i] != 0;
+      }
+      if (any) m_slots[s]->restaurant->OnCompetitorSummary(others);
+    }
+  }
+
+  bool TimeWindowExpired() const {
+    if (m_timeWindow == Clock::duration::zero()) return false;
+    const Clock::duration elapsed(
+        Clock::now().time_since_epoch().count() -
+        m_windowStart.load(std::memory_order_relaxed));
+    return elapsed >= m_timeWindow;
+  }
+
+  const std::uint64_t m_countWindow;
+  const Clock::duration m_timeWindow;
+  std::vector<std::unique_ptr<Slot>> m_slots;
+  std::unordered_map<const Restaurant*, std::size_t> m_slotIdx;
+  /* orders from restaurants that did not subscribe */
+  Slot m_anonymous;
+  std::atomic<std::uint64_t> m_orders{0};
+  std::atomic<Clock::rep> m_windowStart;
+  std::atomic<bool> m_flushing{false};
+  std::atomic<bool> m_flushRequested{false};
+};
+
 /* Mediator */
 class Pattern : public IPattern {
  public:
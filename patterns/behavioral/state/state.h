@@ -1,9 +1,18 @@
 #ifndef __STATE_H__
 #define __STATE_H__
 
+#include <algorithm>
+#include <array>
+#include <barrier>
+#include <cstdint>
+#include <deque>
 #include <iostream>
 #include <memory>
+#include <span>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "../../iPattern.h"
 
@@ -19,31 +28,111 @@ class IState {
   virtual void Cook(Context& context) = 0;
 };
 
+/* Queue of pending orders, run to completion.
+ * States never call each other: a follow-up order is queued and handled
+ * after the current one returns, so the stack depth stays bounded. One
+ * queue can be shared by many contexts to batch their orders.
+ * Contexts must outlive the orders they have queued.
+ */
+class EventQueue {
+ public:
+  void Post(Context& context) { m_events.push_back(&context); }
+
+  /* Handles queued orders, including the ones they raise, until the queue is
+   * empty. Returns the number of handled orders. A nested call (from inside
+   * a state) returns 0 immediately: the outer loop picks the order up */
+  std::size_t Run();
+
+  bool IsRunning() const { return m_running; }
+
+ private:
+  std::deque<Context*> m_events;
+  bool m_running = false;
+};
+
 /* Context */
 class Context {
  public:
-  explicit Context(std::unique_ptr<IState> state) {
+  /* Orders are handled by the context's own queue, right away */
+  explicit Context(std::unique_ptr<IState> state)
+      : Context(std::move(state), nullptr) {}
+
+  /* Orders are batched in a shared queue: call queue.Run() to handle them */
+  Context(std::unique_ptr<IState> state, EventQueue* queue)
+      : m_queue(queue ? queue : &m_ownQueue) {
     SetState(std::move(state));
   }
 
-  /* Update the state */
+  Context(const Context&) = delete;
+  Context& operator=(const Context&) = delete;
+
+  /* Update the state.
+   * A state that is cooking right now is not replaced under its feet: the
+   * new state takes over when the current order is done */
   void SetState(std::unique_ptr<IState> state) {
+    if (m_handling) {
+      m_nextState = std::move(state);
+      return;
+    }
     PrintNewState(*state);
     m_state = std::move(state);
   }
 
   /* Do something useful */
-  void MakeOrder() { m_state->Cook(*this); }
+  void MakeOrder() {
+    m_queue->Post(*this);
+    if (m_queue == &m_ownQueue) m_ownQueue.Run();
+  }
 
  private:
+  friend class EventQueue;
+
+  /* Called by the queue for every order */
+  void HandleOrder() {
+    m_handling = true;
+    try {
+      m_state->Cook(*this);
+    } catch (...) {
+      m_handling = false;
+      throw;
+    }
+    m_handling = false;
+
+    if (m_nextState) SetState(std::move(m_nextState));
+  }
+
   void PrintNewState(const IState& state) const {
     std::cout << PrinterState::Quote
               << "New context state: " << typeid(state).name() << ".\n";
   }
 
   std::unique_ptr<IState> m_state;
+  std::unique_ptr<IState> m_nextState;
+  EventQueue m_ownQueue;
+  EventQueue* m_queue;
+  bool m_handling = false;
 };
 
+inline std::size_t EventQueue::Run() {
+  if (m_running) return 0;
+
+  m_running = true;
+  std::size_t count = 0;
+  try {
+    while (!m_events.empty()) {
+      Context* context = m_events.front();
+      m_events.pop_front();
+      context->HandleOrder();
+      ++count;
+    }
+  } catch (...) {
+    m_running = false;
+    throw;
+  }
+  m_running = false;
+  return count;
+}
+
 /* State 1: Ramen */
 class StateRamen : public IState {
  public:
@@ -85,6 +174,238 @@ void StateRamen::Cook(Context& context) {
   }
 }
 
+/* Table-driven version of the same promo.
+ * States are enum entries, transitions live in a constexpr table and every
+ * customer has its own PromoContext with its own counters. A transition
+ * allocates nothing, so thousands of contexts can run side by side without
+ * sharing any state.
+ */
+enum class PromoState : std::uint8_t { Ramen, BonusGyoza, Count };
+
+/* Events a customer can send. Follow-up events such as "bonus earned" are
+ * raised by the machine itself and cannot be sent from outside */
+enum class PromoEvent : std::uint8_t { Order, Count };
+
+/* Everything one customer needs */
+struct PromoContext {
+  PromoState state = PromoState::Ramen;
+  std::uint32_t ramenCounter = 0;
+  std::uint32_t bonusGyozaCounter = 0;
+};
+
+class PromoMachine {
+ public:
+  /* Handles a customer event and all the follow-up events it raises.
+   * Throws std::out_of_range for an event or state outside the table */
+  static void Dispatch(PromoContext& context, PromoEvent event) {
+    if (event >= PromoEvent::Count) {
+      throw std::out_of_range("Unknown promo event");
+    }
+    /* customer events are the first columns of the table */
+    auto signal = static_cast<Signal>(event);
+    while (signal != Signal::None) {
+      signal = Step(context, signal);
+    }
+  }
+
+ private:
+  /* Columns of the table: the customer's order, then the events that only
+   * actions raise */
+  enum class Signal : std::uint8_t {
+    Order,
+    BonusEarned,
+    ServeBonus,
+    Count,
+    None
+  };
+
+  /* An action updates the context and may raise a follow-up signal */
+  using Action = Signal (*)(PromoContext&);
+
+  struct Transition {
+    PromoState next;
+    Action action;
+  };
+
+  static constexpr std::size_t kStates =
+      static_cast<std::size_t>(PromoState::Count);
+  static constexpr std::size_t kSignals =
+      static_cast<std::size_t>(Signal::Count);
+
+  /* Handles exactly one signal. Returns the follow-up signal (or None) */
+  static Signal Step(PromoContext& context, Signal signal) {
+    if (context.state >= PromoState::Count) {
+      throw std::out_of_range("Unknown promo state");
+    }
+    const Transition& transition =
+        kTable[static_cast<std::size_t>(context.state)]
+              [static_cast<std::size_t>(signal)];
+    context.state = transition.next;
+    return transition.action(context);
+  }
+
+  static Signal Ignore(PromoContext& /* context */) { return Signal::None; }
+
+  static Signal CookRamen(PromoContext& context) {
+    ++context.ramenCounter;
+    return context.ramenCounter % StateRamen::GetBonusGyozaThreshold() == 0
+               ? Signal::BonusEarned
+               : Signal::None;
+  }
+
+  /* entering the bonus state immediately serves the gyoza */
+  static Signal StartBonus(PromoContext& /* context */) {
+    return Signal::ServeBonus;
+  }
+
+  static Signal CookBonusGyoza(PromoContext& context) {
+    ++context.bonusGyozaCounter;
+    return Signal::None;
+  }
+
+  /* kTable[state][signal] */
+  static constexpr std::array<std::array<Transition, kSignals>, kStates>
+      kTable{{/* Ramen */
+              {{{PromoState::Ramen, &CookRamen},
+                {PromoState::BonusGyoza, &StartBonus},
+                {PromoState::Ramen, &Ignore}}},
+              /* BonusGyoza: serve the gyoza and go back to ramen; an order
+               * is still a paid ramen */
+              {{{PromoState::Ramen, &CookRamen},
+                {PromoState::BonusGyoza, &Ignore},
+                {PromoState::Ramen, &CookBonusGyoza}}}}};
+};
+
+/* Promo state of many customers at once, stored as a structure of arrays:
+ * one byte of state and two counters per customer. A batch of events is
+ * applied in one pass with PromoMachine; the batch can be sharded across
+ * threads by customer id, each thread owning a contiguous range of
+ * customers, so no locks are needed.
+ *
+ * Sharding is a parallel counting sort: every thread counts the events of
+ * its part of the batch per shard, the counts become offsets, every thread
+ * copies its events into their buckets and then applies its own bucket.
+ * The copy is stable, so per-customer order is kept, and the total work
+ * stays O(events) whatever the number of threads.
+ */
+class PromoEngine {
+ public:
+  struct Event {
+    std::uint32_t customer;
+    PromoEvent event;
+  };
+
+  explicit PromoEngine(std::size_t customers)
+      : m_states(customers, PromoState::Ramen),
+        m_ramenCounters(customers, 0),
+        m_bonusGyozaCounters(customers, 0) {}
+
+  /* Applies the events in order on the calling thread */
+  void Apply(std::span<const Event> events) {
+    Validate(events);
+    ApplyEvents(events);
+  }
+
+  /* Same result as Apply(events), split across threads */
+  void Apply(std::span<const Event> events, std::size_t threads) {
+    threads = std::max<std::size_t>(1, std::min(threads, m_states.size()));
+    if (threads == 1) {
+      Apply(events);
+      return;
+    }
+
+    /* workers must not throw */
+    Validate(events);
+
+    /* offsets[chunk * threads + shard]: counts first, then where the
+     * chunk's events of that shard go in `sorted` */
+    std::vector<std::size_t> offsets(threads * threads, 0);
+    std::vector<std::size_t> buckets(threads + 1, 0);
+    std::vector<Event> sorted(events.size());
+
+    const auto toOffsets = [&]() noexcept {
+      std::size_t next = 0;
+      for (std::size_t shard = 0; shard < threads; ++shard) {
+        buckets[shard] = next;
+        for (std::size_t chunk = 0; chunk < threads; ++chunk) {
+          const std::size_t count = offsets[chunk * threads + shard];
+          offsets[chunk * threads + shard] = next;
+          next += count;
+        }
+      }
+      buckets[threads] = next;
+    };
+    const auto participants = static_cast<std::ptrdiff_t>(threads);
+    std::barrier counted(participants, toOffsets);
+    std::barrier<> copied(participants);
+
+    const auto work = [&](std::size_t t) {
+      const std::span<const Event> chunk = events.subspan(
+          events.size() * t / threads,
+          events.size() * (t + 1) / threads - events.size() * t / threads);
+      std::size_t* own = offsets.data() + t * threads;
+
+      for (const Event& event : chunk) ++own[Shard(event, threads)];
+      counted.arrive_and_wait();
+
+      for (const Event& event : chunk) {
+        sorted[own[Shard(event, threads)]++] = event;
+      }
+      copied.arrive_and_wait();
+
+      ApplyEvents(std::span<const Event>(sorted).subspan(
+          buckets[t], buckets[t + 1] - buckets[t]));
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (std::size_t t = 1; t < threads; ++t) workers.emplace_back(work, t);
+    work(0);
+    for (auto& worker : workers) worker.join();
+  }
+
+  PromoContext Get(std::uint32_t customer) const {
+    return PromoContext{m_states.at(customer), m_ramenCounters.at(customer),
+                        m_bonusGyozaCounters.at(customer)};
+  }
+
+  std::size_t GetSize() const { return m_states.size(); }
+
+ private:
+  /* Customers only ever send orders: anything else in a batch is rejected
+   * before a single event is applied */
+  void Validate(std::span<const Event> events) const {
+    for (const Event& event : events) {
+      if (event.customer >= m_states.size() ||
+          event.event != PromoEvent::Order) {
+        throw std::out_of_range("Unknown customer or event");
+      }
+    }
+  }
+
+  /* Shards are contiguous, equally sized ranges of customers */
+  std::size_t Shard(const Event& event, std::size_t threads) const {
+    return static_cast<std::size_t>(std::uint64_t{event.customer} * threads /
+                                    m_states.size());
+  }
+
+  void ApplyEvents(std::span<const Event> events) {
+    for (const Event& event : events) {
+      const std::size_t idx = event.customer;
+      PromoContext context{m_states[idx], m_ramenCounters[idx],
+                           m_bonusGyozaCounters[idx]};
+      PromoMachine::Dispatch(context, event.event);
+      m_states[idx] = context.state;
+      m_ramenCounters[idx] = context.ramenCounter;
+      m_bonusGyozaCounters[idx] = context.bonusGyozaCounter;
+    }
+  }
+
+  std::vector<PromoState> m_states;
+  std::vector<std::uint32_t> m_ramenCounters;
+  std::vector<std::uint32_t> m_bonusGyozaCounters;
+};
+
 /* State */
 class Pattern : public IPattern {
  public:
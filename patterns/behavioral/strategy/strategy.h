@@ -1,9 +1,16 @@
 #ifndef __STRATEGY_H__
 #define __STRATEGY_H__
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "../../iPattern.h"
 
@@ -46,7 +53,7 @@ class Context {
 };
 
 /* Strategy 1: Ramen */
-class StrategyRamen : public IStrategy {
+class StrategyRamen final : public IStrategy {
  public:
   void Cook() const override {
     std::cout << PrinterState::PlainText << "Cooking ramen\n";
@@ -54,13 +61,195 @@ class StrategyRamen : public IStrategy {
 };
 
 /* Strategy 2: Gyoza */
-class StrategyGyoza : public IStrategy {
+class StrategyGyoza final : public IStrategy {
  public:
   void Cook() const override {
     std::cout << PrinterState::PlainText << "Cooking gyoza\n";
   }
 };
 
+/* Context with a strategy fixed at compile time (policy-based design).
+ * The strategy is a member, not a heap object, and Cook is called by its
+ * concrete type, so MakeOrder can be inlined */
+template <typename ConcreteStrategy>
+class PolicyContext {
+ public:
+  void MakeOrder() const { m_strategy.Cook(); }
+
+ private:
+  ConcreteStrategy m_strategy;
+};
+
+/* Dishes the kitchen knows how to cook */
+enum class Dish : std::uint8_t { Ramen, Gyoza };
+
+/* Context that switches strategies at runtime without allocation.
+ * Strategies must be stateless; each one gets an entry in a function table
+ * indexed by Enum, and SetStrategy just picks an entry */
+template <typename Enum, typename... Strategies>
+class TableContext {
+ public:
+  explicit TableContext(Enum strategy) { SetStrategy(strategy); }
+
+  void SetStrategy(Enum strategy) {
+    const auto idx = static_cast<std::size_t>(strategy);
+    if (idx >= kTable.size()) {
+      throw std::out_of_range("Unknown strategy");
+    }
+    m_cook = kTable[idx];
+  }
+
+  void MakeOrder() const { m_cook(); }
+
+ private:
+  using CookFn = void (*)();
+
+  template <typename ConcreteStrategy>
+  static void Cook() {
+    ConcreteStrategy().Cook();
+  }
+
+  static constexpr std::array<CookFn, sizeof...(Strategies)> kTable{
+      &Cook<Strategies>...};
+
+  CookFn m_cook = nullptr;
+};
+
+/* Strategies in the order of Dish */
+using DishContext = TableContext<Dish, StrategyRamen, StrategyGyoza>;
+
+/* Cooking times of one strategy in power-of-two nanosecond buckets */
+class TimingHistogram {
+ public:
+  static constexpr std::size_t kBuckets = 40;
+
+  void Record(std::chrono::nanoseconds time) {
+    const auto ns = static_cast<std::uint64_t>(std::max<std::int64_t>(
+        time.count(), 0));
+    std::size_t bucket = 0;
+    while (bucket + 1 < kBuckets && (std::uint64_t{1} << bucket) <= ns) {
+      ++bucket;
+    }
+    ++m_buckets[bucket];
+    ++m_count;
+  }
+
+  /* Number of calls that took less than 2^idx ns (and at least 2^(idx-1)) */
+  std::size_t GetBucket(std::size_t idx) const { return m_buckets[idx]; }
+
+  std::size_t GetCount() const { return m_count; }
+
+ private:
+  std::array<std::size_t, kBuckets> m_buckets{};
+  std::size_t m_count = 0;
+};
+
+/* Context that learns which of several interchangeable strategies is the
+ * fastest for the current workload (epsilon-greedy multi-armed bandit).
+ *
+ * Every call is timed. Each strategy keeps an exponentially weighted
+ * average of its time, so old measurements fade out. Most calls go to the
+ * strategy with the lowest average; every `exploreEvery`-th call goes to the
+ * next strategy in turn, so the estimates stay fresh and the context reacts
+ * when the load changes.
+ */
+class AdaptiveContext {
+ public:
+  /* The best strategy changed at call number `call` */
+  struct Decision {
+    std::uint64_t call;
+    std::size_t strategy;
+  };
+
+  explicit AdaptiveContext(std::vector<std::unique_ptr<IStrategy>> strategies,
+                           std::size_t exploreEvery = 64,
+                           double smoothing = 0.1)
+      : m_strategies(std::move(strategies)),
+        m_arms(m_strategies.size()),
+        m_exploreEvery(std::max<std::size_t>(exploreEvery, 2)),
+        m_smoothing(smoothing) {
+    if (m_strategies.empty()) {
+      throw std::invalid_argument("AdaptiveContext needs a strategy");
+    }
+  }
+
+  void MakeOrder() {
+    const std::size_t idx = Choose();
+    Arm& arm = m_arms[idx];
+
+    const auto start = std::chrono::steady_clock::now();
+    m_strategies[idx]->Cook();
+    const auto time = std::chrono::steady_clock::now() - start;
+
+    const double ns = static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+    arm.average = arm.calls == 0
+                      ? ns
+                      : arm.average + m_smoothing * (ns - arm.average);
+    ++arm.calls;
+    arm.histogram.Record(time);
+
+    UpdateBest();
+  }
+
+  /* The strategy that most calls go to right now */
+  std::size_t GetBest() const { return m_best; }
+
+  /* Every change of the best strategy, oldest first */
+  const std::vector<Decision>& GetDecisions() const { return m_decisions; }
+
+  const TimingHistogram& GetHistogram(std::size_t strategy) const {
+    return m_arms.at(strategy).histogram;
+  }
+
+  /* Smoothed cooking time of a strategy, ns */
+  double GetAverage(std::size_t strategy) const {
+    return m_arms.at(strategy).average;
+  }
+
+ private:
+  struct Arm {
+    double average = 0;
+    std::uint64_t calls = 0;
+    TimingHistogram histogram;
+  };
+
+  std::size_t Choose() {
+    const std::uint64_t call = m_calls++;
+
+    /* warm-up: try every strategy once */
+    if (call < m_arms.size()) return static_cast<std::size_t>(call);
+
+    if (call % m_exploreEvery == 0) {
+      m_explore = (m_explore + 1) % m_arms.size();
+      return m_explore;
+    }
+    return m_best;
+  }
+
+  void UpdateBest() {
+    std::size_t best = m_best;
+    for (std::size_t i = 0; i < m_arms.size(); ++i) {
+      if (m_arms[i].calls != 0 && m_arms[i].average < m_arms[best].average) {
+        best = i;
+      }
+    }
+    if (best != m_best || m_decisions.empty()) {
+      m_best = best;
+      m_decisions.push_back(Decision{m_calls, best});
+    }
+  }
+
+  std::vector<std::unique_ptr<IStrategy>> m_strategies;
+  std::vector<Arm> m_arms;
+  const std::size_t m_exploreEvery;
+  const double m_smoothing;
+  std::uint64_t m_calls = 0;
+  std::size_t m_best = 0;
+  std::size_t m_explore = 0;
+  std::vector<Decision> m_decisions;
+};
+
 /* Strategy Pattern */
 class Pattern : public IPattern {
  public:
@@ -88,6 +88,93 @@ class KFC : public Dinner {
   }
 };
 
+/* Static version of the same dinner (CRTP).
+ * Use it where the concrete dinner is known at compile time: the hooks are
+ * resolved by the compiler, empty hooks compile away and HaveDinner can be
+ * inlined. The virtual Dinner above is still needed for heterogeneous
+ * collections of dinners.
+ */
+namespace Static {
+
+template <typename Derived>
+class Dinner {
+ public:
+  /* Template Method */
+  void HaveDinner() const {
+    WashHand();             /* base */
+    MakeOrder();            /* base */
+    Self().SayBonAppetit(); /* hook */
+    Self().TakeUtensils();  /* required */
+    Eat();                  /* base */
+    Finish();               /* base */
+    Self().ClearTable();    /* hook */
+  }
+
+  const std::string& GetName() const { return m_name; }
+
+  /* Base operations are implemented right here */
+ private:
+  void WashHand() const { Print("Wash hands"); }
+
+  void MakeOrder() const { Print("Make the order"); }
+
+  void Eat() const { Print("Eat"); }
+
+  void Finish() const { Print("Finish"); }
+
+  const Derived& Self() const { return static_cast<const Derived&>(*this); }
+
+  /* Hooks are empty but they can be hidden by the same name in Derived.
+   * There is no default for TakeUtensils: Derived must define it */
+ protected:
+  void SayBonAppetit() const {}
+  void ClearTable() const {}
+
+ protected:
+  explicit Dinner(std::string name) : m_name(std::move(name)) {}
+
+  void Print(const std::string& text) const {
+    std::cout << PrinterState::PlainText << text << '\n';
+  }
+
+  const std::string m_name;
+};
+
+class Ramen : public Dinner<Ramen> {
+ public:
+  Ramen() : Dinner("Ramen") {}
+
+ private:
+  friend class Dinner<Ramen>;
+
+  /* Required */
+  void TakeUtensils() const { Print("Take chopsticks"); }
+
+  /* Hooks */
+  void SayBonAppetit() const { Print("Itadakimasu"); }
+};
+
+class KFC : public Dinner<KFC> {
+ public:
+  KFC() : Dinner("KFC") {}
+
+ private:
+  friend class Dinner<KFC>;
+
+  /* Required */
+  void TakeUtensils() const {
+    /* nothing to do here, we will use our hands */
+  }
+
+  /* Hooks */
+  void ClearTable() const {
+    /* There is no waiter, we should clear the table */
+    Print("Clear the table");
+  }
+};
+
+}  // namespace Static
+
 /* Template Method Pattern */
 class Pattern : public IPattern {
  public:
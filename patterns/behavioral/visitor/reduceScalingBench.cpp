@@ -0,0 +1,87 @@
+/// @file reduceScalingBench.cpp
+/// @brief Scaling benchmark of the parallel Reduce.
+///
+/// Reduces collections of 64K to 16M restaurants with DinnerCostReducer on
+/// 1, 2, 4, ... threads and prints the best of several runs, the throughput
+/// and the speedup over one thread. Run it with `make bench_visitor`; pass
+/// the largest number of threads as the first argument (all cores by
+/// default).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "visitor.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kRuns = 5;
+constexpr std::size_t kSizes[] = {64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+
+/* Best time of kRuns reductions, in milliseconds */
+double BestMs(const std::vector<Visitor::Restaurant>& restaurants,
+              std::size_t threads, Visitor::DinnerCostReducer::Value& result) {
+  const Visitor::DinnerCostReducer reducer(true);
+  double best = 0;
+  for (int run = 0; run < kRuns; ++run) {
+    const auto start = Clock::now();
+    result = Visitor::Reduce(restaurants, reducer, threads);
+    const std::chrono::duration<double, std::milli> elapsed =
+        Clock::now() - start;
+    best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const std::size_t maxThreads =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+               : std::max(1u, std::thread::hardware_concurrency());
+
+  std::cout << "hardware threads: " << std::thread::hardware_concurrency()
+            << ", best of " << kRuns << " runs\n\n"
+            << "restaurants  threads      ms  M restaurants/s  speedup\n";
+
+  bool ok = true;
+  for (const std::size_t size : kSizes) {
+    /* two ramen places for every sushi place */
+    std::vector<Visitor::Restaurant> restaurants;
+    restaurants.reserve(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      if (i % 3 == 2) {
+        restaurants.emplace_back(Visitor::SushiRestaurant{});
+      } else {
+        restaurants.emplace_back(Visitor::RamenRestaurant{});
+      }
+    }
+
+    double oneThreadMs = 0;
+    Visitor::DinnerCostReducer::Value expected = 0;
+    for (std::size_t threads = 1; threads <= maxThreads; threads *= 2) {
+      Visitor::DinnerCostReducer::Value total = 0;
+      const double ms = BestMs(restaurants, threads, total);
+      if (threads == 1) {
+        oneThreadMs = ms;
+        expected = total;
+      }
+      ok &= total == expected;
+
+      std::cout << std::fixed << std::setprecision(2) << std::setw(11)
+                << size << std::setw(9) << threads << std::setw(8) << ms
+                << std::setw(17)
+                << static_cast<double>(size) / ms / 1000.0 << std::setw(8)
+                << oneThreadMs / ms << "x\n";
+    }
+  }
+
+  if (!ok) std::cerr << "FAILED: totals differ between thread counts\n";
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
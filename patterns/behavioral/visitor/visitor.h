@@ -1,9 +1,15 @@
 #ifndef __VISITOR_H__
 #define __VISITOR_H__
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <span>
 #include <string>
+#include <thread>
+#include <utility>
+#include <variant>
 #include <vector>
 
 #include "../../iPattern.h"
@@ -99,6 +105,218 @@ class FridayVisitor : public IVisitor {
   }
 };
 
+/* Closed-set alternative to IComponent.
+ * When the set of components is fixed, they can be stored by value in one
+ * contiguous vector and visited with std::visit: no heap node per component
+ * and no virtual Accept.
+ */
+using Restaurant = std::variant<RamenRestaurant, SushiRestaurant>;
+
+/* Calls the visitor's methods by their qualified names, so the calls are not
+ * virtual even though the visitor implements IVisitor */
+template <typename ConcreteVisitor>
+class StaticDispatch {
+ public:
+  explicit StaticDispatch(const ConcreteVisitor& visitor)
+      : m_visitor(visitor) {}
+
+  void operator()(const RamenRestaurant& component) const {
+    m_visitor.ConcreteVisitor::VisitRamenRestaurant(component);
+  }
+
+  void operator()(const SushiRestaurant& component) const {
+    m_visitor.ConcreteVisitor::VisitSushiRestaurant(component);
+  }
+
+ private:
+  const ConcreteVisitor& m_visitor;
+};
+
+template <typename ConcreteVisitor>
+void VisitRestaurants(const std::vector<Restaurant>& restaurants,
+                      const ConcreteVisitor& visitor) {
+  const StaticDispatch<ConcreteVisitor> dispatch(visitor);
+  for (const auto& restaurant : restaurants) {
+    std::visit(dispatch, restaurant);
+  }
+}
+
+/* Reducing visitor: the total cost of dinner in every restaurant.
+ * A reducer returns a value per component and combines values with an
+ * associative Combine, so a collection can be reduced in any grouping */
+class DinnerCostReducer {
+ public:
+  using Value = long long;
+
+  explicit DinnerCostReducer(bool withDrinks) : m_withDrinks(withDrinks) {}
+
+  Value Identity() const { return 0; }
+
+  Value operator()(const RamenRestaurant& component) const {
+    return component.GetPriceRamen() +
+           (m_withDrinks ? component.GetPriceBeer() : 0);
+  }
+
+  Value operator()(const SushiRestaurant& component) const {
+    return component.GetPriceSushi() +
+           (m_withDrinks ? component.GetPriceSake() : 0);
+  }
+
+  Value Combine(Value lhs, Value rhs) const { return lhs + rhs; }
+
+ private:
+  bool m_withDrinks;
+};
+
+/* Reduces restaurants[begin, end) on the calling thread */
+template <typename Reducer>
+typename Reducer::Value ReduceRange(const std::vector<Restaurant>& restaurants,
+                                   std::size_t begin, std::size_t end,
+                                   const Reducer& reducer) {
+  typename Reducer::Value result = reducer.Identity();
+  for (std::size_t i = begin; i < end; ++i) {
+    result = reducer.Combine(std::move(result),
+                             std::visit(reducer, restaurants[i]));
+  }
+  return result;
+}
+
+/* Splits the collection into one contiguous chunk per thread and combines
+ * the partial results in order, so Combine only has to be associative.
+ * Small collections are reduced on the calling thread */
+template <typename Reducer>
+typename Reducer::Value Reduce(
+    const std::vector<Restaurant>& restaurants, const Reducer& reducer,
+    std::size_t threads = std::thread::hardware_concurrency()) {
+  constexpr std::size_t kMinChunk = 64 * 1024;
+
+  threads = std::min(threads, restaurants.size() / kMinChunk);
+  if (threads <= 1) {
+    return ReduceRange(restaurants, 0, restaurants.size(), reducer);
+  }
+
+  std::vector<typename Reducer::Value> partials(threads);
+  std::vector<std::thread> workers;
+  workers.reserve(threads - 1);
+
+  const std::size_t chunk = restaurants.size() / threads;
+  for (std::size_t t = 1; t < threads; ++t) {
+    const std::size_t begin = t * chunk;
+    const std::size_t end =
+        (t + 1 == threads) ? restaurants.size() : begin + chunk;
+    workers.emplace_back([&, t, begin, end] {
+      partials[t] = ReduceRange(restaurants, begin, end, reducer);
+    });
+  }
+  partials[0] = ReduceRange(restaurants, 0, chunk, reducer);
+
+  for (auto& worker : workers) worker.join();
+
+  typename Reducer::Value result = std::move(partials[0]);
+  for (std::size_t t = 1; t < threads; ++t) {
+    result = reducer.Combine(std::move(result), std::move(partials[t]));
+  }
+  return result;
+}
+
+/* Batch visitor: takes all adjacent components of one type at once.
+ * The loop inside each method sees a single concrete type, so there are no
+ * indirect calls per component and the compiler can vectorize it.
+ */
+class IBatchVisitor {
+ public:
+  virtual ~IBatchVisitor() noexcept = default;
+  virtual void VisitRamenRestaurants(
+      std::span<const RamenRestaurant>) const = 0;
+  virtual void VisitSushiRestaurants(
+      std::span<const SushiRestaurant>) const = 0;
+};
+
+/* Lets a regular visitor visit a RestaurantStore */
+class BatchVisitorAdapter : public IBatchVisitor {
+ public:
+  explicit BatchVisitorAdapter(const IVisitor& visitor) : m_visitor(visitor) {}
+
+  void VisitRamenRestaurants(
+      std::span<const RamenRestaurant> components) const override {
+    for (const auto& component : components) {
+      m_visitor.VisitRamenRestaurant(component);
+    }
+  }
+
+  void VisitSushiRestaurants(
+      std::span<const SushiRestaurant> components) const override {
+    for (const auto& component : components) {
+      m_visitor.VisitSushiRestaurant(component);
+    }
+  }
+
+ private:
+  const IVisitor& m_visitor;
+};
+
+/* Order in which RestaurantStore hands components to a visitor */
+enum class VisitOrder {
+  /* The order of Add calls. Adjacent components of one type are batched */
+  Insertion,
+  /* All ramen restaurants, then all sushi restaurants */
+  ByType,
+};
+
+/* Component container with a dense array per concrete type */
+class RestaurantStore {
+ public:
+  void Add(const RamenRestaurant& component) {
+    m_ramen.push_back(component);
+    m_order.push_back(Kind::Ramen);
+  }
+
+  void Add(const SushiRestaurant& component) {
+    m_sushi.push_back(component);
+    m_order.push_back(Kind::Sushi);
+  }
+
+  void Accept(const IBatchVisitor& visitor,
+              VisitOrder order = VisitOrder::Insertion) const {
+    if (order == VisitOrder::ByType) {
+      if (!m_ramen.empty()) visitor.VisitRamenRestaurants(m_ramen);
+      if (!m_sushi.empty()) visitor.VisitSushiRestaurants(m_sushi);
+      return;
+    }
+
+    /* pass each run of one type as a single batch */
+    std::size_t ramenIdx = 0;
+    std::size_t sushiIdx = 0;
+    for (std::size_t begin = 0; begin < m_order.size();) {
+      const Kind kind = m_order[begin];
+      std::size_t end = begin + 1;
+      while (end < m_order.size() && m_order[end] == kind) ++end;
+
+      const std::size_t count = end - begin;
+      if (kind == Kind::Ramen) {
+        visitor.VisitRamenRestaurants(
+            std::span<const RamenRestaurant>(m_ramen).subspan(ramenIdx, count));
+        ramenIdx += count;
+      } else {
+        visitor.VisitSushiRestaurants(
+            std::span<const SushiRestaurant>(m_sushi).subspan(sushiIdx, count));
+        sushiIdx += count;
+      }
+      begin = end;
+    }
+  }
+
+  std::size_t GetSize() const { return m_order.size(); }
+
+ private:
+  enum class Kind : std::uint8_t { Ramen, Sushi };
+
+  std::vector<RamenRestaurant> m_ramen;
+  std::vector<SushiRestaurant> m_sushi;
+  /* type of each component in insertion order */
+  std::vector<Kind> m_order;
+};
+
 /* Visitor Pattern */
 class Pattern : public IPattern {
  public:
@@ -1,40 +1,270 @@
 #ifndef __COMPOSITE_H__
 #define __COMPOSITE_H__
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <numeric>
+#include <span>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "../../iPattern.h"
 
 /* GoF design pattern: Composite */
 namespace Composite {
 
-/* Component is a base class for Compotises and Leafs */
+class Composite;
+
+/* Fixed set of worker threads with a task deque each.
+ * A worker takes tasks from the back of its own deque and, when it runs
+ * dry, steals from the front of the others. A thread waiting for its tasks
+ * (WaitUntil) keeps running tasks meanwhile, so fork-join never deadlocks.
+ */
+class WorkStealingPool {
+ public:
+  explicit WorkStealingPool(
+      std::size_t threads = std::thread::hardware_concurrency()) {
+    threads = std::max<std::size_t>(threads, 1);
+    /* the last queue is for threads that are not workers */
+    for (std::size_t i = 0; i <= threads; ++i) {
+      m_queues.push_back(std::make_unique<Queue>());
+    }
+    for (std::size_t i = 0; i < threads; ++i) {
+      m_workers.emplace_back([this, i] { WorkerLoop(i); });
+    }
+  }
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  ~WorkStealingPool() noexcept {
+    {
+      std::lock_guard<std::mutex> lock(m_sleepMutex);
+      m_stop = true;
+    }
+    m_wakeUp.notify_all();
+    for (auto& worker : m_workers) worker.join();
+  }
+
+  void Submit(std::function<void()> task) {
+    Queue& queue = *m_queues[GetOwnQueue()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    m_queued.fetch_add(1, std::memory_order_release);
+    {
+      /* a worker between its check and its wait must not miss this */
+      std::lock_guard<std::mutex> lock(m_sleepMutex);
+    }
+    m_wakeUp.notify_one();
+  }
+
+  /* Runs pending tasks until done() returns true */
+  template <typename Predicate>
+  void WaitUntil(Predicate done) {
+    const std::size_t own = GetOwnQueue();
+    while (!done()) {
+      if (!TryRunOne(own)) std::this_thread::yield();
+    }
+  }
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::size_t GetOwnQueue() const {
+    return t_pool == this ? t_index : m_queues.size() - 1;
+  }
+
+  bool TryRunOne(std::size_t own) {
+    std::function<void()> task;
+    for (std::size_t i = 0; i < m_queues.size() && !task; ++i) {
+      Queue& queue = *m_queues[(own + i) % m_queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tasks.empty()) continue;
+      if (i == 0) {
+        task = std::move(queue.tasks.back()); /* own: newest first */
+        queue.tasks.pop_back();
+      } else {
+        task = std::move(queue.tasks.front()); /* steal: oldest first */
+        queue.tasks.pop_front();
+      }
+    }
+    if (!task) return false;
+
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+    task();
+    return true;
+  }
+
+  void WorkerLoop(std::size_t idx) {
+    t_pool = this;
+    t_index = idx;
+    while (true) {
+      if (TryRunOne(idx)) continue;
+
+      std::unique_lock<std::mutex> lock(m_sleepMutex);
+      m_wakeUp.wait(lock, [this] {
+        return m_stop || m_queued.load(std::memory_order_acquire) > 0;
+      });
+      if (m_stop) return;
+    }
+  }
+
+  inline static thread_local const WorkStealingPool* t_pool = nullptr;
+  inline static thread_local std::size_t t_index = 0;
+
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_workers;
+  std::atomic<std::size_t> m_queued{0};
+  std::mutex m_sleepMutex;
+  std::condition_variable m_wakeUp;
+  bool m_stop = false;
+};
+
+/* Memory block shared by the nodes of a tree that is loaded in bulk (see
+ * BinaryOrderCodec). The block grows geometrically. It is freed when the
+ * last node allocated from it is destroyed and its creator let it go.
+ */
+class NodeArena {
+ public:
+  NodeArena(const NodeArena&) = delete;
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  /* The creator holds a reference and must Release it */
+  static NodeArena* Create(std::size_t initialSize) {
+    return new NodeArena(initialSize);
+  }
+
+  /* Every allocation is a reference, released by the node's destruction */
+  void* Allocate(std::size_t size, std::size_t alignment) {
+    void* memory = m_resource.allocate(size, alignment);
+    m_refs.fetch_add(1, std::memory_order_relaxed);
+    return memory;
+  }
+
+  void Release() {
+    if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+ private:
+  explicit NodeArena(std::size_t initialSize) : m_resource(initialSize) {}
+  ~NodeArena() noexcept = default;
+
+  std::pmr::monotonic_buffer_resource m_resource;
+  std::atomic<std::size_t> m_refs{1};
+};
+
+/* Component is a base class for Compotises and Leafs.
+ * A composite owns its children; parent pointers do not own anything.
+ */
 class Component {
  public:
+  /* Identifies a child in the composite that returned it. A handle whose
+   * child has been removed meanwhile is detected, not dereferenced. The
+   * owner is a process-wide composite id, not an address: a composite
+   * created where a destroyed one used to be never accepts its handles */
+  struct Handle {
+    std::uint64_t owner = 0;
+    std::uint32_t slot = 0;
+    std::uint32_t generation = 0;
+  };
+
   explicit Component(std::string name) : Component(std::move(name), 0) {}
   virtual ~Component() noexcept = default;
 
+  Component(const Component&) = delete;
+  Component& operator=(const Component&) = delete;
+
+  /* Nodes are either on the heap or in a NodeArena. Deleting one goes
+   * through here, so std::unique_ptr<Component> works for both */
+  static void operator delete(Component* node, std::destroying_delete_t) {
+    NodeArena* arena = node->m_arena;
+    node->~Component();
+    if (arena) {
+      arena->Release();
+    } else {
+      ::operator delete(node);
+    }
+  }
+
   /* this is the main method, must be overridden */
   virtual int GetPrice() const = 0;
 
-  /* add and remove */
-  virtual void Add(std::shared_ptr<Component>) {}
-  virtual void Remove(std::shared_ptr<Component>) {}
+  /* Same as GetPrice, but subtrees of at least `threshold` components are
+   * priced as parallel tasks */
+  virtual int GetPriceParallel(WorkStealingPool& /* pool */,
+                               std::size_t /* threshold */) const {
+    return GetPrice();
+  }
+
+  /* Adds a child and returns it. Only a composite can have children.
+   * The component is taken over only if it was added */
+  virtual Component* Add(std::unique_ptr<Component>&&) {
+    throw std::runtime_error("Only a composite can have children");
+  }
+
+  /* Removes a child and hands it back, nullptr if it is not a child */
+  virtual std::unique_ptr<Component> Remove(const Component*) {
+    return nullptr;
+  }
 
   virtual bool IsComposite() const { return false; }
 
   const std::string& GetName() const { return m_name; }
 
+  /* The composite this component belongs to, or nullptr */
+  const Component* GetParent() const { return m_parent; }
+
+  /* Number of components in the subtree, this one included */
+  std::size_t GetSubtreeSize() const { return m_subtreeSize; }
+
  protected:
+  friend class Composite;
+  friend class BinaryOrderCodec;
+
   Component(std::string name, int price)
       : m_name(std::move(name)), m_price(price) {}
 
+  /* Marks the cached prices of all ancestors as stale. A dirty node always
+   * has dirty ancestors, so the walk stops at the first dirty one */
+  void InvalidateAncestors() {
+    for (Component* node = m_parent;
+         node && !node->m_dirty.load(std::memory_order_relaxed);
+         node = node->m_parent) {
+      node->m_dirty.store(true, std::memory_order_relaxed);
+    }
+  }
+
   std::string m_name;
   int m_price = 0;
+  Component* m_parent = nullptr;
+  /* slot of this component in m_parent, valid if m_parent */
+  std::uint32_t m_slot = 0;
+  std::size_t m_subtreeSize = 1;
+  /* a composite's cached price is stale. Readers may refresh the cache
+   * concurrently, so it is atomic; see Composite */
+  mutable std::atomic<bool> m_dirty{true};
+  /* where the node was allocated, nullptr for the heap */
+  NodeArena* m_arena = nullptr;
 };
 
 /* Leaf has its own price */
@@ -43,35 +273,668 @@ class Leaf : public Component {
   Leaf(std::string name, int price) : Component(std::move(name), price) {}
 
   int GetPrice() const override { return m_price; }
+
+  void SetPrice(int price) {
+    m_price = price;
+    InvalidateAncestors();
+  }
 };
 
-/* Composite contains leafes and other composites */
+/* Composite contains leafes and other composites.
+ * The subtree price is cached: GetPrice is O(1) when nothing changed, and a
+ * change only marks the path to the root as dirty. Each component can
+ * belong to one composite at a time.
+ *
+ * Any number of threads may call GetPrice or GetPriceParallel on the same
+ * tree: they refresh the cache through atomics and compute the same value.
+ * Changing the tree needs exclusive access, as with any other container.
+ *
+ * Every child has a slot that records its position in the list, so
+ * removing it is O(1). A slot's generation changes when the child leaves,
+ * which is how stale handles are recognized.
+ */
 class Composite : public Component {
  public:
-  explicit Composite(std::string name) : Component(std::move(name)) {}
+  using Children = std::list<std::unique_ptr<Component>>;
 
-  void Add(std::shared_ptr<Component> component) override {
+  explicit Composite(std::string name)
+      : Component(std::move(name)), m_id(NextId()) {}
+
+  /* Children die with the composite. The tree is torn down with a work
+   * list instead of recursion, so deep trees cannot overflow the stack */
+  ~Composite() noexcept override {
+    Children pending;
+    pending.splice(pending.end(), m_children);
+    while (!pending.empty()) {
+      Component* node = pending.front().get();
+      if (node->IsComposite()) {
+        auto& children = static_cast<Composite*>(node)->m_children;
+        pending.splice(pending.end(), children);
+      }
+      pending.pop_front();
+    }
+  }
+
+  Component* Add(std::unique_ptr<Component>&& component) override {
+    Component* child = component.get();
+    AddChild(std::move(component));
+    return child;
+  }
+
+  /* Removing a child is O(1): the child knows its slot */
+  std::unique_ptr<Component> Remove(const Component* component) override {
+    if (!component || component->m_parent != this) return nullptr;
+    return Detach(component->m_slot);
+  }
+
+  /* Same as Add. The handle allows removing the child in O(1) */
+  Handle AddChild(std::unique_ptr<Component>&& component) {
+    if (!component) throw std::runtime_error("The component is empty");
     /* check to avoid a loop */
-    if (component.get() == this) {
-      throw std::runtime_error("You cannot add the same component");
+    for (const Component* node = this; node; node = node->m_parent) {
+      if (component.get() == node) {
+        throw std::runtime_error("You cannot add the same component");
+      }
+    }
+    if (component->m_parent) {
+      throw std::runtime_error("The component already has a parent");
     }
-    m_children.push_back(std::move(component));
+
+    Component& child = *component;
+    const std::uint32_t slot = Link(std::move(component));
+    AddToSubtreeSize(child.m_subtreeSize, true);
+    Invalidate();
+    return Handle{m_id, slot, m_slots[slot].generation};
   }
 
-  void Remove(std::shared_ptr<Component> component) override {
-    m_children.remove(component);
+  /* Removes the child and hands it back. Throws if the handle is not from
+   * this composite or its child has already been removed */
+  std::unique_ptr<Component> RemoveChild(Handle handle) {
+    if (handle.owner != m_id || handle.slot >= m_slots.size() ||
+        !m_slots[handle.slot].used ||
+        m_slots[handle.slot].generation != handle.generation) {
+      throw std::runtime_error("The handle is stale");
+    }
+    return Detach(handle.slot);
   }
 
   bool IsComposite() const override { return true; }
 
+  const Children& GetChildren() const { return m_children; }
+
   int GetPrice() const override {
-    return std::accumulate(
+    if (!m_dirty.load(std::memory_order_acquire)) {
+      return m_cachedPrice.load(std::memory_order_relaxed);
+    }
+    return StorePrice(std::accumulate(
         m_children.begin(), m_children.end(), 0,
-        [](int sum, auto item) { return sum += item->GetPrice(); });
+        [](int sum, const auto& item) { return sum + item->GetPrice(); }));
+  }
+
+  int GetPriceParallel(WorkStealingPool& pool,
+                       std::size_t threshold) const override {
+    if (!m_dirty.load(std::memory_order_acquire)) {
+      return m_cachedPrice.load(std::memory_order_relaxed);
+    }
+    if (m_subtreeSize < threshold) return GetPrice();
+
+    /* fork: big children become tasks, small ones are priced right here */
+    std::vector<int> prices(m_children.size(), 0);
+    std::atomic<std::size_t> pending{0};
+    std::size_t idx = 0;
+    for (const auto& child : m_children) {
+      if (child->m_subtreeSize >= threshold) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        pool.Submit([&, idx, node = child.get()] {
+          prices[idx] = node->GetPriceParallel(pool, threshold);
+          pending.fetch_sub(1, std::memory_order_release);
+        });
+      } else {
+        prices[idx] = child->GetPrice();
+      }
+      ++idx;
+    }
+
+    /* join */
+    pool.WaitUntil(
+        [&] { return pending.load(std::memory_order_acquire) == 0; });
+
+    return StorePrice(std::accumulate(prices.begin(), prices.end(), 0));
   }
 
  protected:
-  std::list<std::shared_ptr<Component>> m_children;
+  friend class BinaryOrderCodec;
+
+  /* Position of a child in m_children. Free slots are reused */
+  struct Slot {
+    Children::iterator position;
+    std::uint32_t generation = 0;
+    bool used = false;
+  };
+
+  void Invalidate() {
+    m_dirty.store(true, std::memory_order_relaxed);
+    InvalidateAncestors();
+  }
+
+  /* Publishes a fresh price: whoever sees the clean flag sees the price */
+  int StorePrice(int price) const {
+    m_cachedPrice.store(price, std::memory_order_relaxed);
+    m_dirty.store(false, std::memory_order_release);
+    return price;
+  }
+
+  /* Ids start at 1, so a default-constructed Handle matches nothing */
+  static std::uint64_t NextId() {
+    static std::atomic<std::uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /* Keeps subtree sizes of this composite and its ancestors up to date */
+  void AddToSubtreeSize(std::size_t delta, bool grow) {
+    for (Component* node = this; node; node = node->m_parent) {
+      node->m_subtreeSize =
+          grow ? node->m_subtreeSize + delta : node->m_subtreeSize - delta;
+    }
+  }
+
+  /* Appends the child and gives it a slot. Sizes and prices are up to the
+   * caller */
+  std::uint32_t Link(std::unique_ptr<Component> component) {
+    if (m_freeSlots.empty()) {
+      m_slots.emplace_back();
+      m_freeSlots.push_back(static_cast<std::uint32_t>(m_slots.size() - 1));
+    }
+    const std::uint32_t slot = m_freeSlots.back();
+    Component& child = *component;
+    m_slots[slot].position =
+        m_children.insert(m_children.end(), std::move(component));
+    m_slots[slot].used = true;
+    m_freeSlots.pop_back();
+
+    child.m_parent = this;
+    child.m_slot = slot;
+    return slot;
+  }
+
+  std::unique_ptr<Component> Detach(std::uint32_t slot) {
+    Slot& entry = m_slots[slot];
+    std::unique_ptr<Component> child = std::move(*entry.position);
+    m_children.erase(entry.position);
+    entry.used = false;
+    ++entry.generation;
+    m_freeSlots.push_back(slot);
+
+    child->m_parent = nullptr;
+    AddToSubtreeSize(child->m_subtreeSize, false);
+    Invalidate();
+    return child;
+  }
+
+  const std::uint64_t m_id;
+  Children m_children;
+  std::vector<Slot> m_slots;
+  std::vector<std::uint32_t> m_freeSlots;
+  mutable std::atomic<int> m_cachedPrice{0};
+};
+
+/* Flat, arena-backed version of an order tree.
+ * All nodes live in one array in breadth-first order, so the children of a
+ * node are a contiguous index range and every child comes after its parent.
+ * Names live in one shared string. Prices of all subtrees are computed with
+ * one backward linear scan when the tree is built.
+ *
+ * Nodes are addressed by the ids FlatOrderBuilder returned.
+ */
+class FlatOrder {
+ public:
+  using NodeId = std::uint32_t;
+
+  static constexpr NodeId kNoParent = UINT32_MAX;
+
+  std::size_t GetSize() const { return m_nodes.size(); }
+
+  /* Ids of the children in the order they were added. The range is a view
+   * of one contiguous array, no copy is made */
+  std::span<const NodeId> GetChildren(NodeId id) const {
+    const Node& node = m_nodes[m_position[id]];
+    return std::span<const NodeId>(m_ids).subspan(node.firstChild,
+                                                  node.childCount);
+  }
+
+  /* Id of the parent, kNoParent for the root */
+  NodeId GetParent(NodeId id) const {
+    const std::uint32_t parent = m_nodes[m_position[id]].parent;
+    return parent == kNoParent ? kNoParent : m_ids[parent];
+  }
+
+  std::string_view GetName(NodeId id) const {
+    const Node& node = m_nodes[m_position[id]];
+    return std::string_view(m_names).substr(node.nameOffset, node.nameLength);
+  }
+
+  /* Price of the subtree, O(1) */
+  long long GetPrice(NodeId id) const { return m_totals[m_position[id]]; }
+
+  bool IsComposite(NodeId id) const {
+    return m_nodes[m_position[id]].isComposite;
+  }
+
+ private:
+  friend class FlatOrderBuilder;
+
+  struct Node {
+    std::uint32_t nameOffset;
+    std::uint32_t nameLength;
+    std::uint32_t parent;     /* position of the parent, or kNoParent */
+    std::uint32_t firstChild; /* children: [firstChild, +childCount) */
+    std::uint32_t childCount;
+    int price; /* own price, 0 for composites */
+    bool isComposite;
+  };
+
+  std::vector<Node> m_nodes;
+  std::vector<long long> m_totals;
+  /* builder id -> position in m_nodes, and back */
+  std::vector<std::uint32_t> m_position;
+  std::vector<NodeId> m_ids;
+  std::string m_names;
+};
+
+/* Builds a FlatOrder. Add nodes in any order, like Composite::Add */
+class FlatOrderBuilder {
+ public:
+  using NodeId = FlatOrder::NodeId;
+
+  explicit FlatOrderBuilder(std::string_view rootName) {
+    AddNode(FlatOrder::kNoParent, rootName, 0, true);
+  }
+
+  static constexpr NodeId GetRoot() { return 0; }
+
+  NodeId AddComposite(NodeId parent, std::string_view name) {
+    return AddNode(CheckParent(parent), name, 0, true);
+  }
+
+  NodeId AddLeaf(NodeId parent, std::string_view name, int price) {
+    return AddNode(CheckParent(parent), name, price, false);
+  }
+
+  FlatOrder Build() const {
+    const std::size_t size = m_nodes.size();
+
+    /* children of every node, grouped by parent (counting sort) */
+    std::vector<std::uint32_t> childStart(size + 1, 0);
+    for (std::size_t i = 1; i < size; ++i) ++childStart[m_nodes[i].parent + 1];
+    for (std::size_t i = 0; i < size; ++i) childStart[i + 1] += childStart[i];
+    std::vector<std::uint32_t> children(size - 1);
+    std::vector<std::uint32_t> fill(childStart.begin(), childStart.end() - 1);
+    for (std::size_t i = 1; i < size; ++i) {
+      children[fill[m_nodes[i].parent]++] = static_cast<std::uint32_t>(i);
+    }
+
+    /* breadth-first layout: children end up next to each other */
+    FlatOrder order;
+    order.m_names = m_names;
+    order.m_nodes.reserve(size);
+    order.m_position.assign(size, 0);
+    order.m_ids.reserve(size);
+    std::vector<std::uint32_t> queue{0};
+    queue.reserve(size);
+    for (std::size_t head = 0; head < queue.size(); ++head) {
+      const std::uint32_t id = queue[head];
+      FlatOrder::Node node = m_nodes[id];
+      if (node.parent != FlatOrder::kNoParent) {
+        node.parent = order.m_position[node.parent];
+      }
+      node.firstChild = static_cast<std::uint32_t>(queue.size());
+      node.childCount = childStart[id + 1] - childStart[id];
+      queue.insert(queue.end(), children.begin() + childStart[id],
+                   children.begin() + childStart[id + 1]);
+
+      order.m_position[id] = static_cast<std::uint32_t>(head);
+      order.m_ids.push_back(id);
+      order.m_nodes.push_back(node);
+    }
+
+    /* children come after parents: one backward pass prices every subtree */
+    order.m_totals.resize(size);
+    for (std::size_t i = size; i-- > 0;) {
+      order.m_totals[i] += order.m_nodes[i].price;
+      if (order.m_nodes[i].parent != FlatOrder::kNoParent) {
+        order.m_totals[order.m_nodes[i].parent] += order.m_totals[i];
+      }
+    }
+    return order;
+  }
+
+ private:
+  NodeId AddNode(std::uint32_t parent, std::string_view name, int price,
+                 bool isComposite) {
+    FlatOrder::Node node{};
+    node.nameOffset = static_cast<std::uint32_t>(m_names.size());
+    node.nameLength = static_cast<std::uint32_t>(name.size());
+    node.parent = parent;
+    node.price = price;
+    node.isComposite = isComposite;
+
+    m_names.append(name);
+    m_nodes.push_back(node);
+    return static_cast<NodeId>(m_nodes.size() - 1);
+  }
+
+  std::uint32_t CheckParent(NodeId parent) const {
+    if (parent >= m_nodes.size() || !m_nodes[parent].isComposite) {
+      throw std::runtime_error("The parent must be a composite");
+    }
+    return parent;
+  }
+
+  std::vector<FlatOrder::Node> m_nodes;
+  std::string m_names;
+};
+
+/* Compact binary format for order trees.
+ *
+ *   header:  "RCO1", varint name count, varint composite count,
+ *            varint leaf count
+ *   names:   varint length + bytes, each distinct name once
+ *   nodes:   pre-order; varint (name index << 1 | is composite), then
+ *            varint child count (composite) or zigzag varint price (leaf)
+ *
+ * Decode reads the stream once. Every node is placed in one NodeArena, so
+ * loading is a pointer bump per node instead of a heap allocation. The
+ * header counts only pick the arena's first block (capped, it grows as
+ * needed); they are checked against the size of the input and against the
+ * nodes actually read. Nodes are linked to their parent directly, and the
+ * subtree sizes and prices are summed up when a composite is complete, so
+ * loading is O(N) whatever the depth. The nodes are owned as usual: the
+ * arena lives as long as any of them.
+ */
+class BinaryOrderCodec {
+ public:
+  static void Encode(const Component& root, std::ostream& os) {
+    std::vector<const std::string*> names;
+    std::unordered_map<std::string_view, std::uint64_t> nameIdx;
+    std::string body;
+    std::uint64_t composites = 0;
+    std::uint64_t leaves = 0;
+
+    /* pre-order with an explicit stack: trees can be deep */
+    std::vector<const Component*> stack{&root};
+    while (!stack.empty()) {
+      const Component* node = stack.back();
+      stack.pop_back();
+
+      const auto inserted = nameIdx.emplace(node->GetName(), names.size());
+      if (inserted.second) names.push_back(&node->GetName());
+      const std::uint64_t tag = inserted.first->second << 1;
+
+      if (node->IsComposite()) {
+        const auto& children =
+            static_cast<const Composite&>(*node).GetChildren();
+        PutVarint(body, tag | 1);
+        PutVarint(body, children.size());
+        for (auto it = children.rbegin(); it != children.rend(); ++it) {
+          stack.push_back(it->get());
+        }
+        ++composites;
+      } else {
+        PutVarint(body, tag);
+        PutVarint(body, ZigZag(node->GetPrice()));
+        ++leaves;
+      }
+    }
+
+    std::string header(kMagic, sizeof(kMagic));
+    PutVarint(header, names.size());
+    PutVarint(header, composites);
+    PutVarint(header, leaves);
+    for (const std::string* name : names) {
+      PutVarint(header, name->size());
+      header += *name;
+    }
+
+    os.write(header.data(), static_cast<std::streamsize>(header.size()));
+    os.write(body.data(), static_cast<std::streamsize>(body.size()));
+  }
+
+  static std::string Encode(const Component& root) {
+    std::ostringstream os;
+    Encode(root, os);
+    return std::move(os).str();
+  }
+
+  static std::unique_ptr<Component> Decode(std::istream& is) {
+    Reader reader(*is.rdbuf());
+
+    char magic[sizeof(kMagic)];
+    for (char& c : magic) c = static_cast<char>(reader.Byte());
+    if (!std::equal(magic, magic + sizeof(magic), kMagic)) {
+      throw std::runtime_error("Not an order tree");
+    }
+
+    const std::uint64_t nameCount = reader.Varint();
+    const std::uint64_t composites = reader.Varint();
+    const std::uint64_t leaves = reader.Varint();
+
+    /* the counts are only hints until checked: a name takes at least one
+     * byte and a node at least two */
+    const std::uint64_t available = reader.Remaining();
+    if (nameCount == 0 || nameCount > available ||
+        composites > (available - nameCount) / 2 ||
+        leaves > (available - nameCount) / 2 - composites ||
+        composites + leaves == 0) {
+      throw std::runtime_error("The order tree header is corrupted");
+    }
+
+    std::vector<std::string> names;
+    names.reserve(std::min<std::uint64_t>(nameCount, kMaxReserve));
+    for (std::uint64_t i = 0; i < nameCount; ++i) {
+      names.push_back(reader.String(reader.Varint()));
+    }
+
+    /* a small buffer that grows geometrically as nodes are read */
+    const std::uint64_t hint =
+        composites * sizeof(Composite) + leaves * sizeof(Leaf);
+    const ArenaRef arena{NodeArena::Create(static_cast<std::size_t>(
+        std::clamp<std::uint64_t>(hint, kMinArena, kMaxArena)))};
+
+    /* Composites still missing children, innermost last. Their size and
+     * price are summed up as children complete; the price is summed in 64
+     * bits, so a total that does not fit an int is caught, not wrapped */
+    struct Open {
+      Composite* composite;
+      std::uint64_t missing;
+      std::int64_t price;
+    };
+    std::vector<Open> open;
+    std::unique_ptr<Component> root;
+    std::uint64_t compositesLeft = composites;
+    std::uint64_t leavesLeft = leaves;
+
+    do {
+      const std::uint64_t tag = reader.Varint();
+      const std::uint64_t name = tag >> 1;
+      if (name >= names.size()) throw std::runtime_error("Bad name index");
+
+      std::unique_ptr<Component> node;
+      std::uint64_t children = 0;
+      if (tag & 1) {
+        if (compositesLeft-- == 0) {
+          throw std::runtime_error("More composites than in the header");
+        }
+        node = Make<Composite>(*arena.arena, names[name]);
+        children = reader.Varint();
+      } else {
+        if (leavesLeft-- == 0) {
+          throw std::runtime_error("More leaves than in the header");
+        }
+        node = Make<Leaf>(*arena.arena, names[name],
+                          UnZigZag(reader.Varint()));
+      }
+
+      /* link directly: no loop check and no walk over the ancestors */
+      Component* done = node.get();
+      if (root) {
+        open.back().composite->Link(std::move(node));
+      } else {
+        root = std::move(node);
+      }
+
+      if (children != 0) {
+        open.push_back(Open{static_cast<Composite*>(done), children, 0});
+        continue;
+      }
+      if (done->IsComposite()) { /* no children */
+        static_cast<Composite*>(done)->StorePrice(0);
+      }
+
+      /* fold the finished node into the composites it completes */
+      while (!open.empty()) {
+        Open& top = open.back();
+        top.composite->m_subtreeSize += done->m_subtreeSize;
+        top.price += done->GetPrice();
+        if (!FitsInt(top.price)) {
+          throw std::runtime_error("The order tree price is out of range");
+        }
+        if (--top.missing != 0) break;
+
+        top.composite->StorePrice(static_cast<int>(top.price));
+        done = top.composite;
+        open.pop_back();
+      }
+    } while (!open.empty());
+
+    if (compositesLeft != 0 || leavesLeft != 0) {
+      throw std::runtime_error("Fewer nodes than in the header");
+    }
+    return root;
+  }
+
+  static std::unique_ptr<Component> Decode(const std::string& data) {
+    std::istringstream is(data);
+    return Decode(is);
+  }
+
+ private:
+  static constexpr char kMagic[4] = {'R', 'C', 'O', '1'};
+  /* nothing larger is allocated on the word of the header alone */
+  static constexpr std::uint64_t kMaxReserve = 64 * 1024;
+  static constexpr std::uint64_t kMinArena = 4 * 1024;
+  static constexpr std::uint64_t kMaxArena = 1024 * 1024;
+
+  /* The decoder's own reference to the arena */
+  struct ArenaRef {
+    NodeArena* arena;
+
+    ~ArenaRef() noexcept { arena->Release(); }
+  };
+
+  /* Constructs a node in the arena */
+  template <typename T, typename... Args>
+  static std::unique_ptr<Component> Make(NodeArena& arena, Args&&... args) {
+    void* memory = arena.Allocate(sizeof(T), alignof(T));
+    Component* node = nullptr;
+    try {
+      node = new (memory) T(std::forward<Args>(args)...);
+    } catch (...) {
+      arena.Release();
+      throw;
+    }
+    node->m_arena = &arena;
+    return std::unique_ptr<Component>(node);
+  }
+
+  /* Sequential reader on top of a stream buffer */
+  class Reader {
+   public:
+    explicit Reader(std::streambuf& buf) : m_buf(buf) {}
+
+    std::uint8_t Byte() {
+      const auto c = m_buf.sbumpc();
+      if (c == std::streambuf::traits_type::eof()) {
+        throw std::runtime_error("Unexpected end of the order tree");
+      }
+      return static_cast<std::uint8_t>(c);
+    }
+
+    std::uint64_t Varint() {
+      std::uint64_t value = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+        const std::uint8_t byte = Byte();
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return value;
+      }
+      throw std::runtime_error("Varint is too long");
+    }
+
+    /* Reads in chunks, so a bogus size fails at the end of the input
+     * instead of allocating it up front */
+    std::string String(std::uint64_t size) {
+      std::string str;
+      while (str.size() < size) {
+        const std::size_t chunk = static_cast<std::size_t>(
+            std::min<std::uint64_t>(size - str.size(), kMaxReserve));
+        const std::size_t offset = str.size();
+        str.resize(offset + chunk);
+        const auto read = m_buf.sgetn(str.data() + offset,
+                                      static_cast<std::streamsize>(chunk));
+        if (static_cast<std::size_t>(read) != chunk) {
+          throw std::runtime_error("Unexpected end of the order tree");
+        }
+      }
+      return str;
+    }
+
+    /* Bytes left in a seekable input, the maximum otherwise */
+    std::uint64_t Remaining() {
+      constexpr auto kUnknown = std::numeric_limits<std::uint64_t>::max();
+      const std::streambuf::pos_type kFailed(std::streambuf::off_type(-1));
+
+      const auto current = m_buf.pubseekoff(0, std::ios_base::cur,
+                                            std::ios_base::in);
+      if (current == kFailed) return kUnknown;
+      const auto end = m_buf.pubseekoff(0, std::ios_base::end,
+                                        std::ios_base::in);
+      m_buf.pubseekpos(current, std::ios_base::in);
+      if (end == kFailed || end < current) return kUnknown;
+      return static_cast<std::uint64_t>(end - current);
+    }
+
+   private:
+    std::streambuf& m_buf;
+  };
+
+  static void PutVarint(std::string& out, std::uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+  }
+
+  static std::uint64_t ZigZag(int value) {
+    const auto wide = static_cast<std::int64_t>(value);
+    return (static_cast<std::uint64_t>(wide) << 1) ^
+           static_cast<std::uint64_t>(wide >> 63);
+  }
+
+  static bool FitsInt(std::int64_t value) {
+    return value >= std::numeric_limits<int>::min() &&
+           value <= std::numeric_limits<int>::max();
+  }
+
+  /* Prices are ints: anything wider can only come from a corrupted file */
+  static int UnZigZag(std::uint64_t value) {
+    const std::int64_t wide = static_cast<std::int64_t>(value >> 1) ^
+                              -static_cast<std::int64_t>(value & 1);
+    if (!FitsInt(wide)) {
+      throw std::runtime_error("The order tree price is out of range");
+    }
+    return static_cast<int>(wide);
+  }
+
 };
 
 /* Composite Pattern */
@@ -94,50 +957,34 @@ class Pattern : public IPattern {
               << "have to pay the check. But how do we calculate who spent how "
               << "much? Fortunately, the check is a composite.\n";
 
-    /* create the order */
-    std::shared_ptr<Component> totalOrder =
-        std::make_shared<Composite>("TotalOrder");
-    std::shared_ptr<Component> myOrder =
-        std::make_shared<Composite>("My Order");
-    std::shared_ptr<Component> gfOrder =
-        std::make_shared<Composite>("My GF's order");
-
-    std::shared_ptr<Component> friendsRamen =
-        std::make_shared<Leaf>("Friend's ramen", 1000);
-
-    std::shared_ptr<Component> myRamen =
-        std::make_shared<Leaf>("My ramen", 1200);
-    std::shared_ptr<Component> myGyoza =
-        std::make_shared<Leaf>("My gyoza", 500);
-    std::shared_ptr<Component> myBeer = std::make_shared<Leaf>("My beer", 400);
-
-    std::shared_ptr<Component> gfMochi =
-        std::make_shared<Leaf>("Gf's mochi", 350);
-    std::shared_ptr<Component> gfCoffe =
-        std::make_shared<Leaf>("Gf's coffe", 250);
+    /* create the order, every composite owns what is added to it */
+    std::unique_ptr<Component> totalOrder =
+        std::make_unique<Composite>("TotalOrder");
 
     /* build the tree */
-    totalOrder->Add(friendsRamen);
-    totalOrder->Add(myOrder);
+    totalOrder->Add(std::make_unique<Leaf>("Friend's ramen", 1000));
+    Component* myOrder =
+        totalOrder->Add(std::make_unique<Composite>("My Order"));
 
-    myOrder->Add(myRamen);
-    myOrder->Add(myGyoza);
-    myOrder->Add(myBeer);
-    myOrder->Add(gfOrder);
+    Component* myRamen = myOrder->Add(std::make_unique<Leaf>("My ramen", 1200));
+    myOrder->Add(std::make_unique<Leaf>("My gyoza", 500));
+    myOrder->Add(std::make_unique<Leaf>("My beer", 400));
+    Component* gfOrder =
+        myOrder->Add(std::make_unique<Composite>("My GF's order"));
 
-    gfOrder->Add(gfMochi);
-    gfOrder->Add(gfCoffe);
+    gfOrder->Add(std::make_unique<Leaf>("Gf's mochi", 350));
+    gfOrder->Add(std::make_unique<Leaf>("Gf's coffe", 250));
 
     /* print */
-    PrintPrice(totalOrder);
-    PrintPrice(myOrder);
-    PrintPrice(gfOrder);
-    PrintPrice(myRamen);
+    PrintPrice(*totalOrder);
+    PrintPrice(*myOrder);
+    PrintPrice(*gfOrder);
+    PrintPrice(*myRamen);
   }
 
-  static void PrintPrice(std::shared_ptr<Component> component) {
-    std::cout << PrinterState::PlainText << "Price of " << component->GetName()
-              << " = " << component->GetPrice() << "\n";
+  static void PrintPrice(const Component& component) {
+    std::cout << PrinterState::PlainText << "Price of " << component.GetName()
+              << " = " << component.GetPrice() << "\n";
   }
 };
 
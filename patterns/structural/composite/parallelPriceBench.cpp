@@ -0,0 +1,106 @@
+/// @file parallelPriceBench.cpp
+/// @brief Benchmark of GetPriceParallel against the sequential GetPrice.
+///
+/// Builds order trees of different fan-out and depth, marks every leaf as
+/// changed and times a full re-pricing both ways. Prints the best of several
+/// runs and the speedup. Run it with `make bench_composite`; pass the number
+/// of worker threads as the first argument (all cores by default).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "composite.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kRuns = 5;
+constexpr std::size_t kThreshold = 4096;
+
+struct Shape {
+  int fanOut;
+  int depth;
+};
+
+/* from deep and narrow to shallow and wide, 250k to 1M leaves each */
+constexpr Shape kShapes[] = {{2, 18}, {4, 9}, {8, 6}, {32, 4}, {1000, 2}};
+
+void Build(Composite::Component& node, const Shape& shape, int depth,
+           std::vector<Composite::Leaf*>& leaves) {
+  for (int i = 0; i < shape.fanOut; ++i) {
+    if (depth == shape.depth) {
+      auto leaf = std::make_unique<Composite::Leaf>("item", i % 100 + 1);
+      leaves.push_back(leaf.get());
+      node.Add(std::move(leaf));
+    } else {
+      Build(*node.Add(std::make_unique<Composite::Composite>("group")), shape,
+            depth + 1, leaves);
+    }
+  }
+}
+
+/* Best time of kRuns full re-pricings. Touching every leaf makes the whole
+ * tree dirty, so nothing is served from the cache */
+template <typename Price>
+double BestMs(const std::vector<Composite::Leaf*>& leaves, Price price,
+              int& result) {
+  double best = 0;
+  for (int run = 0; run < kRuns; ++run) {
+    for (Composite::Leaf* leaf : leaves) leaf->SetPrice(leaf->GetPrice());
+    const auto start = Clock::now();
+    result = price();
+    const std::chrono::duration<double, std::milli> elapsed =
+        Clock::now() - start;
+    best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const std::size_t threads =
+      argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+               : std::max(1u, std::thread::hardware_concurrency());
+  Composite::WorkStealingPool pool(threads);
+
+  std::cout << "threads: " << threads
+            << ", hardware threads: " << std::thread::hardware_concurrency()
+            << ", threshold: " << kThreshold << ", best of " << kRuns
+            << " runs\n\n"
+            << "fan-out  depth    leaves  sequential ms  parallel ms"
+            << "  speedup\n";
+
+  bool ok = true;
+  for (const Shape& shape : kShapes) {
+    Composite::Composite root("order");
+    std::vector<Composite::Leaf*> leaves;
+    Build(root, shape, 1, leaves);
+
+    int sequential = 0;
+    int parallel = 0;
+    const double sequentialMs =
+        BestMs(leaves, [&] { return root.GetPrice(); }, sequential);
+    const double parallelMs = BestMs(
+        leaves, [&] { return root.GetPriceParallel(pool, kThreshold); },
+        parallel);
+    ok &= sequential == parallel;
+
+    std::cout << std::fixed << std::setprecision(2) << std::setw(7)
+              << shape.fanOut << std::setw(7) << shape.depth << std::setw(10)
+              << leaves.size() << std::setw(15) << sequentialMs
+              << std::setw(13) << parallelMs << std::setw(8)
+              << sequentialMs / parallelMs << "x\n";
+  }
+
+  if (!ok) std::cerr << "FAILED: parallel and sequential prices differ\n";
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,16 +1,34 @@
 #ifndef __DECORATOR_H__
 #define __DECORATOR_H__
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "../../iPattern.h"
 
 /* GoF design pattern: Decorator */
 namespace Decorator {
 
+/* Toppings on the menu: what each one adds to the food. Both the runtime
+ * decorators and the compile-time combos take their data from here. A new
+ * topping is a new descriptor and decorator; nothing else has to change */
+struct GyozaTopping {
+  static constexpr int kPrice = 500;
+  static constexpr std::string_view kSuffix = " + Gyoza";
+};
+
+struct BeerTopping {
+  static constexpr int kPrice = 350;
+  static constexpr std::string_view kSuffix = " + Beer";
+};
+
 /* Food interface */
 class IFood {
  public:
@@ -18,6 +36,11 @@ class IFood {
 
   virtual int GetPrice() const = 0;
   virtual std::string GetDescription() const = 0;
+
+  /* Appends the description to `out` instead of returning a new string */
+  virtual void AppendDescription(std::string& out) const {
+    out += GetDescription();
+  }
 };
 
 /* Simple Ramen */
@@ -26,57 +49,222 @@ class Ramen : public IFood {
   int GetPrice() const override { return 1000; }
 
   std::string GetDescription() const override { return "Ramen"; }
+
+  void AppendDescription(std::string& out) const override { out += "Ramen"; }
 };
 
-/* Decorator interface, contains a pointer to the IFood component */
+/* Decorator interface, contains a pointer to the IFood component.
+ *
+ * A chain is immutable once built, so the price and the length of the
+ * decorators' part of the description are computed once in the constructor.
+ * The description is written into one buffer in a single pass over the
+ * chain: the base food first, then the suffixes, filled in from the back.
+ * That pass reads the inner decorators' data instead of calling them, so
+ * the price and the description are final: a decorator is defined by what
+ * it passes to this constructor, not by overriding them.
+ */
 class IDecorator : public IFood {
  public:
-  explicit IDecorator(std::shared_ptr<IFood> component)
-      : m_component(std::move(component)) {}
+  IDecorator(std::shared_ptr<IFood> component, int price,
+             std::string suffix)
+      : m_component(std::move(component)),
+        m_inner(dynamic_cast<const IDecorator*>(m_component.get())),
+        m_base(m_inner ? m_inner->m_base : m_component.get()),
+        m_suffix(std::move(suffix)),
+        m_suffixSize(m_suffix.size() + (m_inner ? m_inner->m_suffixSize : 0)),
+        m_extraPrice(price),
+        m_price(m_component->GetPrice() + price) {}
 
-  int GetPrice() const override { return this->getComponent().GetPrice(); }
+  /* What this decorator alone adds to the food */
+  int GetExtraPrice() const { return m_extraPrice; }
+  std::string_view GetSuffix() const { return m_suffix; }
 
-  std::string GetDescription() const override {
-    return this->getComponent().GetDescription();
+  int GetPrice() const final { return m_price; }
+
+  std::string GetDescription() const final {
+    std::string description;
+    AppendDescription(description);
+    return description;
+  }
+
+  void AppendDescription(std::string& out) const final {
+    m_base->AppendDescription(out);
+
+    std::size_t end = out.size() + m_suffixSize;
+    out.resize(end);
+    for (const IDecorator* dec = this; dec != nullptr; dec = dec->m_inner) {
+      end -= dec->m_suffix.size();
+      dec->m_suffix.copy(out.data() + end, dec->m_suffix.size());
+    }
   }
 
  protected:
   const IFood& getComponent() const { return *m_component; }
 
  private:
+  friend class FlatFood;
+
   std::shared_ptr<IFood> m_component;
+  const IDecorator* m_inner; /* the component if it is a decorator too */
+  const IFood* m_base;       /* the food at the bottom of the chain */
+  std::string m_suffix;
+  std::size_t m_suffixSize; /* of all the suffixes down the chain */
+  int m_extraPrice;
+  int m_price;
 };
 
 /* Conctete decorator: Gyoza */
 class DecoratorGyoza : public IDecorator {
  public:
   explicit DecoratorGyoza(std::shared_ptr<IFood> component)
-      : IDecorator(component) {}
+      : IDecorator(std::move(component), GyozaTopping::kPrice,
+                   std::string(GyozaTopping::kSuffix)) {}
+};
+
+/* Conctete decorator: Beer */
+class DecoratorBeer : public IDecorator {
+ public:
+  explicit DecoratorBeer(std::shared_ptr<IFood> component)
+      : IDecorator(std::move(component), BeerTopping::kPrice,
+                   std::string(BeerTopping::kSuffix)) {}
+};
+
+/* A decorator chain flattened into the base food and a contiguous list of
+ * (suffix, price, quantity) entries. Runs of decorators with the same suffix
+ * and price collapse into one entry, so ten beers in a row take one entry
+ * instead of ten heap nodes.
+ * Only consecutive toppings are merged, which keeps the description
+ * identical to the one of the chain.
+ */
+class FlatFood : public IFood {
+ public:
+  struct Entry {
+    std::string suffix;
+    int price;
+    std::uint32_t quantity;
+  };
+
+  explicit FlatFood(const std::shared_ptr<IFood>& food) : m_base(food) {
+    /* the chain is walked from the outermost decorator inwards */
+    const auto* dec = dynamic_cast<const IDecorator*>(food.get());
+    const IDecorator* innermost = nullptr;
+    for (; dec != nullptr; dec = dec->m_inner) {
+      if (!m_entries.empty() && m_entries.back().suffix == dec->m_suffix &&
+          m_entries.back().price == dec->m_extraPrice) {
+        ++m_entries.back().quantity;
+      } else {
+        m_entries.push_back({dec->m_suffix, dec->m_extraPrice, 1});
+      }
+      innermost = dec;
+    }
+    if (innermost != nullptr) m_base = innermost->m_component;
+    std::reverse(m_entries.begin(), m_entries.end());
 
-  int GetPrice() const override {
-    return this->getComponent().GetPrice() + 500;
+    m_price = m_base->GetPrice();
+    for (const Entry& entry : m_entries) {
+      m_price += entry.price * static_cast<int>(entry.quantity);
+      m_suffixSize += entry.suffix.size() * entry.quantity;
+    }
   }
 
+  int GetPrice() const override { return m_price; }
+
   std::string GetDescription() const override {
-    return this->getComponent().GetDescription() + " + Gyoza";
+    std::string description;
+    AppendDescription(description);
+    return description;
   }
+
+  void AppendDescription(std::string& out) const override {
+    m_base->AppendDescription(out);
+    out.reserve(out.size() + m_suffixSize);
+    for (const Entry& entry : m_entries) {
+      for (std::uint32_t i = 0; i < entry.quantity; ++i) out += entry.suffix;
+    }
+  }
+
+  const IFood& GetBase() const { return *m_base; }
+  const std::vector<Entry>& GetEntries() const { return m_entries; }
+
+ private:
+  std::shared_ptr<IFood> m_base;
+  std::vector<Entry> m_entries;
+  std::size_t m_suffixSize = 0;
+  int m_price = 0;
 };
 
-/* Conctete decorator: Beer */
-class DecoratorBeer : public IDecorator {
+/* Compile-time decorators for set menus that are known at build time.
+ * WithBeer<WithGyoza<Ramen>> is a plain type: its price and description are
+ * constants, nothing is allocated and nothing is called through a pointer.
+ */
+namespace Static {
+
+/* Characters of a description, null-terminated, built in constant evaluation
+ */
+template <std::size_t N>
+struct Text {
+  std::array<char, N + 1> chars{};
+
+  constexpr std::string_view View() const { return {chars.data(), N}; }
+};
+
+template <std::size_t N>
+constexpr Text<N - 1> MakeText(const char (&text)[N]) {
+  Text<N - 1> result;
+  for (std::size_t i = 0; i + 1 < N; ++i) result.chars[i] = text[i];
+  return result;
+}
+
+/* The length of the tail has to be given explicitly: a string_view argument
+ * is not a constant expression inside the function */
+template <std::size_t M, std::size_t N>
+constexpr Text<N + M> Concat(const Text<N>& head, std::string_view tail) {
+  Text<N + M> result;
+  for (std::size_t i = 0; i < N; ++i) result.chars[i] = head.chars[i];
+  for (std::size_t i = 0; i < M; ++i) result.chars[N + i] = tail[i];
+  return result;
+}
+
+/* Simple Ramen */
+struct Ramen {
+  static constexpr int kPrice = 1000;
+  static constexpr auto kText = MakeText("Ramen");
+  static constexpr std::string_view kDescription = kText.View();
+};
+
+/* Adds a topping to Food. Price and suffix come from the same descriptor as
+ * the runtime decorator, so both forms always agree */
+template <typename Food, typename Topping>
+struct With {
+  static constexpr int kPrice = Food::kPrice + Topping::kPrice;
+  static constexpr auto kText =
+      Concat<Topping::kSuffix.size()>(Food::kText, Topping::kSuffix);
+  static constexpr std::string_view kDescription = kText.View();
+};
+
+template <typename Food>
+using WithGyoza = With<Food, GyozaTopping>;
+
+template <typename Food>
+using WithBeer = With<Food, BeerTopping>;
+
+/* Exposes a compile-time food through the runtime interface */
+template <typename Food>
+class AsFood final : public IFood {
  public:
-  explicit DecoratorBeer(std::shared_ptr<IFood> component)
-      : IDecorator(component) {}
+  int GetPrice() const override { return Food::kPrice; }
 
-  int GetPrice() const override {
-    return this->getComponent().GetPrice() + 350;
+  std::string GetDescription() const override {
+    return std::string(Food::kDescription);
   }
 
-  std::string GetDescription() const override {
-    return this->getComponent().GetDescription() + " + Beer";
+  void AppendDescription(std::string& out) const override {
+    out += Food::kDescription;
   }
 };
 
+}  // namespace Static
+
 /* Decorator Pattern */
 class Pattern : public IPattern {
  public: